@@ -0,0 +1,387 @@
+//
+// bench.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+// Kernel benchmarks, built by `make bench` and run headless by `make run-bench`
+// in QEMU's stm32vldiscovery machine. Each result is printed through semihosting
+// as one JSON object per line, e.g.
+//     {"bench": "syscall_round_trip", "iterations": 1000, "cycles": 212, "clock": "systick"}
+// where cycles is the average cost of one iteration.
+//
+
+#include "../src/ktos.h"
+#include "../CMSIS/CM3/CoreSupport/core_cm3.h"
+
+#define BENCH_ITERATIONS 1000
+#define BENCH_SHORT_ITERATIONS 100
+#define BENCH_BLOCK_SIZE 64
+#define FRAGMENTATION_SLOTS 16
+#define FRAGMENTATION_MAX_SIZE 192
+
+#define BENCH_PRIORITY 2
+#define PONG_PRIORITY 3
+#define PING_PRIORITY 4
+#define TRIGGER_PRIORITY 5
+#define SPAWN_PRIORITY 6
+
+#define SEMIHOSTING_SYS_WRITE0 0x04
+#define SEMIHOSTING_SYS_EXIT 0x18
+#define SEMIHOSTING_APPLICATION_EXIT 0x20026
+
+static uint8_t use_dwt = 0;
+static uint32_t timing_overhead = 0;
+
+static volatile uint8_t bench_pid;
+static volatile uint8_t ping_pid;
+static volatile uint8_t pong_pid;
+static volatile uint8_t trigger_pid;
+static volatile uint32_t ping_cycles;
+static volatile uint32_t isr_wake_stamp;
+static uint32_t random_state = 1;
+
+
+// Semihosting is served by QEMU (or by an attached debugger), without either the bkpt faults.
+static int Semihost(int operation, void *arg) {
+    register int r0 asm("r0") = operation;
+    register void *r1 asm("r1") = arg;
+    __asm__ __volatile__ ("bkpt 0xab" : "+r" (r0) : "r" (r1) : "memory");
+    return r0;
+}
+
+static void BenchPrintf(const char *format, ...) {
+    char line[128];
+    va_list args;
+
+    va_start(args, format);
+    FormatString(line, sizeof(line), format, args);
+    va_end(args);
+    Semihost(SEMIHOSTING_SYS_WRITE0, line);
+}
+
+static void Report(const char *name, uint32_t iterations, uint32_t cycles) {
+    BenchPrintf("{\"bench\": \"%s\", \"iterations\": %u, \"cycles\": %u, \"clock\": \"%s\"}\n",
+                name, iterations, cycles, use_dwt ? "dwt" : "systick");
+}
+
+// No timings are reported for a bench whose operation failed.
+static void BenchFailed(const char *name, uint32_t iteration, int result) {
+    BenchPrintf("{\"bench\": \"%s\", \"iteration\": %u, \"error\": %d}\n", name, iteration, result);
+}
+
+// DWT is not emulated by QEMU, fall back to SysTick if its counter does not move.
+static inline uint32_t BenchCycles(void) {
+    return use_dwt ? GetCycleCount() : (uint32_t) GetTimeCycles();
+}
+
+static void InitBenchClock(void) {
+    uint32_t start = GetCycleCount();
+    for (volatile int i = 0; i < 100; i++);
+    use_dwt = GetCycleCount() != start;
+
+    // The cost of taking a timestamp, taken off the single shot measurements.
+    timing_overhead = 0xffffffff;
+    for (int i = 0; i < 10; i++) {
+        start = BenchCycles();
+        uint32_t elapsed = BenchCycles() - start;
+        if (elapsed < timing_overhead) {
+            timing_overhead = elapsed;
+        }
+    }
+}
+
+
+static void BenchSyscall(void) {
+    // A wait for notify with no timeout returns at once, that is an SVC round trip.
+    uint32_t start = BenchCycles();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        TaskNotifyWait(0);
+    }
+    Report("syscall_round_trip", BENCH_ITERATIONS, (BenchCycles() - start) / BENCH_ITERATIONS);
+}
+
+static void BenchQueue(void) {
+    uint32_t item;
+    uint32_t start = BenchCycles();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        QueueSendToBlock(0, i, 0);
+        QueueReceiveFromBlock(0, &item, 0);
+    }
+    Report("queue_send_receive", BENCH_ITERATIONS, (BenchCycles() - start) / BENCH_ITERATIONS);
+}
+
+static void BenchMemBlock(void) {
+    mem_block_header_t *blocks[8];
+    uint32_t alloc_cycles = 0;
+    uint32_t free_cycles = 0;
+    uint32_t start;
+
+    for (int i = 0; i < BENCH_SHORT_ITERATIONS; i++) {
+        // Allocate and free a few blocks at once, so that the free lists are not trivial.
+        for (int j = 0; j < 8; j++) {
+            EnterCritical();
+            start = BenchCycles();
+            blocks[j] = AllocateMemBlock(BENCH_BLOCK_SIZE);
+            alloc_cycles += BenchCycles() - start - timing_overhead;
+            LeaveCritical();
+        }
+        for (int j = 7; j >= 0; j--) {
+            EnterCritical();
+            start = BenchCycles();
+            if (blocks[j] != NULL) {
+                FreeMemBlock(blocks[j]);
+            }
+            free_cycles += BenchCycles() - start - timing_overhead;
+            LeaveCritical();
+        }
+    }
+    Report("alloc_mem_block", BENCH_SHORT_ITERATIONS * 8, alloc_cycles / (BENCH_SHORT_ITERATIONS * 8));
+    Report("free_mem_block", BENCH_SHORT_ITERATIONS * 8, free_cycles / (BENCH_SHORT_ITERATIONS * 8));
+}
+
+// Same pattern as BenchMemBlock, on a pool of blocks of BENCH_BLOCK_SIZE.
+static void BenchBlockPool(void) {
+    void *blocks[8];
+    uint32_t alloc_cycles = 0;
+    uint32_t free_cycles = 0;
+    uint32_t start;
+    uint8_t pool_id;
+
+    if (BlockPoolCreateFromHeap(BENCH_BLOCK_SIZE, 8, &pool_id) != BLOCK_POOL_OK) {
+        return;
+    }
+    for (int i = 0; i < BENCH_SHORT_ITERATIONS; i++) {
+        for (int j = 0; j < 8; j++) {
+            start = BenchCycles();
+            blocks[j] = BlockAlloc(pool_id, 0);
+            alloc_cycles += BenchCycles() - start - timing_overhead;
+        }
+        for (int j = 7; j >= 0; j--) {
+            start = BenchCycles();
+            BlockFree(pool_id, blocks[j]);
+            free_cycles += BenchCycles() - start - timing_overhead;
+        }
+    }
+    BlockPoolDelete(pool_id);
+    Report("block_alloc", BENCH_SHORT_ITERATIONS * 8, alloc_cycles / (BENCH_SHORT_ITERATIONS * 8));
+    Report("block_free", BENCH_SHORT_ITERATIONS * 8, free_cycles / (BENCH_SHORT_ITERATIONS * 8));
+}
+
+// Linear congruential generator, so that every run churns the heap the same way.
+static uint32_t BenchRandom(void) {
+    random_state = random_state * 1664525 + 1013904223;
+    return random_state >> 16;
+}
+
+// The largest block that could be allocated right now, found by bisection.
+static uint32_t LargestAllocatable(void) {
+    mem_block_header_t *block;
+    uint32_t low = 0;
+    uint32_t high = MEM_POOL_SIZE;
+
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        EnterCritical();
+        block = AllocateMemBlock(middle);
+        if (block != NULL) {
+            FreeMemBlock(block);
+        }
+        LeaveCritical();
+        if (block != NULL) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+// Fragmentation: blocks of random sizes are allocated and freed in random order,
+//   then the largest block that could still be allocated is compared with the bytes
+//   left free. The worst case of a single allocation or free is reported as well.
+static void BenchFragmentation(void) {
+    mem_block_header_t *blocks[FRAGMENTATION_SLOTS] = {NULL};
+    uint32_t free_bytes = LargestAllocatable(); // in one piece, as nothing is allocated yet
+    uint32_t worst = 0;
+    uint32_t failed = 0;
+    uint32_t start, elapsed, slot, size;
+
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        slot = BenchRandom() % FRAGMENTATION_SLOTS;
+        size = 8 + BenchRandom() % FRAGMENTATION_MAX_SIZE;
+
+        if (blocks[slot] != NULL) {
+            free_bytes += HEADER_SIZE + blocks[slot]->size;
+            EnterCritical();
+            start = BenchCycles();
+            FreeMemBlock(blocks[slot]);
+            elapsed = BenchCycles() - start - timing_overhead;
+            LeaveCritical();
+            blocks[slot] = NULL;
+        } else {
+            EnterCritical();
+            start = BenchCycles();
+            blocks[slot] = AllocateMemBlock(size);
+            elapsed = BenchCycles() - start - timing_overhead;
+            LeaveCritical();
+            if (blocks[slot] != NULL) {
+                free_bytes -= HEADER_SIZE + blocks[slot]->size;
+            } else {
+                failed++;
+            }
+        }
+        if (elapsed > worst) {
+            worst = elapsed;
+        }
+    }
+
+    uint32_t largest = LargestAllocatable();
+    BenchPrintf("{\"bench\": \"heap_fragmentation\", \"iterations\": %u, \"free\": %u, \"largest\": %u, "
+                "\"fragmentation_permille\": %u, \"failed\": %u}\n",
+                BENCH_ITERATIONS, free_bytes, largest,
+                free_bytes ? 1000 - largest * 1000 / free_bytes : 0, failed);
+    Report("heap_operation_worst", BENCH_ITERATIONS, worst);
+
+    for (int i = 0; i < FRAGMENTATION_SLOTS; i++) {
+        if (blocks[i] != NULL) {
+            EnterCritical();
+            FreeMemBlock(blocks[i]);
+            LeaveCritical();
+        }
+    }
+}
+
+
+// Context switch: ping and pong hand the CPU to each other through notifications,
+//   each round trip takes two switches, two notifies and two waits.
+static void PongTask(void) {
+    pong_pid = GetCurrentTaskPid();
+    while (1) {
+        TaskNotifyWait(NO_TIMEOUT);
+        TaskNotify(ping_pid);
+    }
+}
+
+static void PingTask(void) {
+    ping_pid = GetCurrentTaskPid();
+    uint32_t start = BenchCycles();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        TaskNotify(pong_pid);
+        TaskNotifyWait(NO_TIMEOUT);
+    }
+    ping_cycles = BenchCycles() - start;
+    TaskNotify(bench_pid);
+}
+
+static void BenchContextSwitch(void) {
+    // Pong runs first as it has the higher priority, then blocks and lets ping run.
+    TaskCreate((TaskFunction) PongTask, 0, 384, PONG_PRIORITY, "pong");
+    TaskCreate((TaskFunction) PingTask, 0, 384, PING_PRIORITY, "ping");
+    TaskNotifyWait(NO_TIMEOUT);
+    Report("context_switch_round_trip", BENCH_ITERATIONS, ping_cycles / BENCH_ITERATIONS);
+}
+
+
+// ISR to task: the trigger task pends EXTI0 while the bench task waits for notify,
+//   the time is taken from the ISR to the bench task running again.
+void EXTI0_IRQHandler(void) {
+    isr_wake_stamp = BenchCycles();
+    TaskNotify(bench_pid);
+}
+
+static void TriggerTask(void) {
+    trigger_pid = GetCurrentTaskPid();
+    while (1) {
+        TaskNotifyWait(NO_TIMEOUT);
+        NVIC_SetPendingIRQ(EXTI0_IRQn);
+    }
+}
+
+static void BenchIsrWake(void) {
+    uint32_t total = 0;
+    uint32_t worst = 0;
+    uint32_t elapsed;
+
+    NVIC_SetPriority(EXTI0_IRQn, NVIC_EncodePriority(0, 1, 0));
+    NVIC_EnableIRQ(EXTI0_IRQn);
+    TaskCreate((TaskFunction) TriggerTask, 0, 384, TRIGGER_PRIORITY, "trigger");
+    // Let the trigger task publish its pid.
+    TaskSleep(1);
+
+    for (int i = 0; i < BENCH_SHORT_ITERATIONS; i++) {
+        TaskNotify(trigger_pid);
+        TaskNotifyWait(NO_TIMEOUT);
+        elapsed = BenchCycles() - isr_wake_stamp - timing_overhead;
+        total += elapsed;
+        if (elapsed > worst) {
+            worst = elapsed;
+        }
+    }
+    Report("isr_to_task_wake", BENCH_SHORT_ITERATIONS, total / BENCH_SHORT_ITERATIONS);
+    Report("isr_to_task_wake_max", BENCH_SHORT_ITERATIONS, worst);
+}
+
+
+static void SpawnedTask(void) {
+    // Not run, it is deleted right after being created.
+}
+
+// The task control blocks and pids are recycled, so create and delete could go on for good.
+static void BenchTaskCreate(void) {
+    uint32_t create_cycles = 0;
+    uint32_t delete_cycles = 0;
+    uint32_t start;
+    task_handle_t handle;
+    int result;
+
+    for (int i = 0; i < BENCH_SHORT_ITERATIONS; i++) {
+        start = BenchCycles();
+        result = TaskCreateWithArena((TaskFunction) SpawnedTask, 0, 256, 0, SPAWN_PRIORITY, "spawn", &handle);
+        create_cycles += BenchCycles() - start - timing_overhead;
+        if (result != TASK_OK) {
+            BenchFailed("task_create", i, result);
+            return;
+        }
+
+        start = BenchCycles();
+        result = TaskDelete(handle);
+        delete_cycles += BenchCycles() - start - timing_overhead;
+        if (result != TASK_OK) {
+            BenchFailed("task_delete", i, result);
+            return;
+        }
+    }
+    Report("task_create", BENCH_SHORT_ITERATIONS, create_cycles / BENCH_SHORT_ITERATIONS);
+    Report("task_delete", BENCH_SHORT_ITERATIONS, delete_cycles / BENCH_SHORT_ITERATIONS);
+}
+
+
+static void BenchTask(void) {
+    bench_pid = GetCurrentTaskPid();
+    InitBenchClock();
+
+    BenchSyscall();
+    BenchQueue();
+    BenchMemBlock();
+    BenchBlockPool();
+    BenchFragmentation();
+    BenchContextSwitch();
+    BenchIsrWake();
+    BenchTaskCreate();
+
+    Semihost(SEMIHOSTING_SYS_EXIT, (void *) SEMIHOSTING_APPLICATION_EXIT);
+    while (1);
+}
+
+int main(void) {
+    InitQueueControlBlock();
+    InitTaskControlBlock();
+    InitTimerControlBlock();
+    InitBlockPoolControlBlock();
+
+    TaskCreate((TaskFunction) BenchTask, 0, 768, BENCH_PRIORITY, "bench");
+
+    ktOSStart();
+
+    while (1);
+}
@@ -0,0 +1,109 @@
+//
+// clock.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#include "clock.h"
+#include "ktos.h"
+
+#define NS_PER_TICK (1000000000 / SYSTICK_FREQUENCY_HZ)
+
+void InitClock(void) {
+    PortInitCycleCounter();
+}
+
+// Timeouts given by the user, NO_TIMEOUT is kept and the others saturate below it.
+uint32_t MsToTicks(uint32_t ms) {
+    if (ms == NO_TIMEOUT) {
+        return NO_TIMEOUT;
+    }
+    if (ms > (NO_TIMEOUT - 1) / TICKS_PER_MS) {
+        return NO_TIMEOUT - 1;
+    }
+    return MS_TO_TICKS(ms);
+}
+
+uint32_t UsToTicks(uint32_t us) {
+    if (us == NO_TIMEOUT) {
+        return NO_TIMEOUT;
+    }
+    return US_TO_TICKS(us);
+}
+
+// Read the tick count and the elapsed cycles of the current tick as a pair.
+//   If the tick has ended but the tick handler has not run yet (we are in a critical
+//   region, or in an ISR with higher priority), the tick is not counted yet,
+//   so it is added here.
+static void ReadTicks(uint64_t *ticks, uint32_t *sub_cycles) {
+    uint8_t tick_pending;
+    
+    EnterCritical();
+    uint64_t this_ticks = GetTickCount64();
+    uint32_t this_sub_cycles = PortGetTickCycles(&tick_pending);
+    if (tick_pending) {
+        this_ticks++;
+    }
+    LeaveCritical();
+    
+    *ticks = this_ticks;
+    *sub_cycles = this_sub_cycles;
+}
+
+uint64_t GetTimeCycles(void) {
+    uint64_t ticks;
+    uint32_t sub_cycles;
+    ReadTicks(&ticks, &sub_cycles);
+    return ticks * PortGetCyclesPerTick() + sub_cycles;
+}
+
+// Cycles elapsed since the given tick began, it must be less than 2^32 cycles ago.
+uint32_t GetCyclesSinceTick(uint32_t tick) {
+    uint64_t ticks;
+    uint32_t sub_cycles;
+    ReadTicks(&ticks, &sub_cycles);
+    return ((uint32_t) ticks - tick) * PortGetCyclesPerTick() + sub_cycles;
+}
+
+// Only 32-bit divisions are used here, the 64-bit ones would pull in libgcc.
+uint64_t GetTimeNs(void) {
+    uint64_t ticks;
+    uint32_t sub_cycles;
+    ReadTicks(&ticks, &sub_cycles);
+    return ticks * NS_PER_TICK + sub_cycles * 1000 / (SystemCoreClock / 1000000);
+}
+
+
+#if USE_TIM2_ONE_SHOT
+// Only one wait could be served at a time, by the one-shot timer of the port.
+static uint8_t one_shot_task = (uint8_t) -1;
+
+// Must be called inside a critical region, after the task is set to wait for notify.
+uint8_t OneShotStart(uint32_t us, uint8_t task_pid) {
+    if (one_shot_task != (uint8_t) -1 || us == 0 || us > 0xffff) {
+        return 0;
+    }
+    
+    one_shot_task = task_pid;
+    PortOneShotStart(us);
+    return 1;
+}
+
+// Called by the kernel when the task is killed, so that its wait is not
+//   ended by notifying the next task given its pid. The timer is left to expire.
+//   must be called inside a critical region.
+void _OneShotForgetTask(uint8_t task_pid) {
+    if (one_shot_task == task_pid) {
+        one_shot_task = (uint8_t) -1;
+    }
+}
+
+// Called by the port once the one-shot timer has expired.
+void _ktOneShotHandler(void) {
+    uint8_t task_pid = one_shot_task;
+    one_shot_task = (uint8_t) -1;
+    if (task_pid != (uint8_t) -1) {
+        TaskNotify(task_pid);
+    }
+}
+#endif
@@ -0,0 +1,45 @@
+//
+// clock.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_CLOCK_H
+#define KTOS_CLOCK_H
+
+#include "types.h"
+#include "config.h"
+
+// Convert to ticks, rounding up so that a wait never ends early.
+#define MS_TO_TICKS(ms) ((ms) * TICKS_PER_MS)
+#define US_TO_TICKS(us) ((us) / SYSTICK_INTERVAL_US + ((us) % SYSTICK_INTERVAL_US != 0))
+
+// Compare two tick counts, taking the wrap-around of systicks into account.
+static inline uint8_t TimeReached(uint32_t now, uint32_t expiry) {
+    return (int32_t) (now - expiry) >= 0;
+}
+
+void InitClock(void);
+
+uint32_t MsToTicks(uint32_t ms);
+
+uint32_t UsToTicks(uint32_t us);
+
+#if USE_TIM2_ONE_SHOT
+uint8_t OneShotStart(uint32_t us, uint8_t task_pid);
+
+void _OneShotForgetTask(uint8_t task_pid);
+#endif
+
+uint64_t GetTimeCycles(void);
+
+uint64_t GetTimeNs(void);
+
+uint32_t GetCyclesSinceTick(uint32_t tick);
+
+// Free running 32-bit cycle counter, wraps after 2^32 core cycles (about 59s at 72MHz).
+static inline uint32_t GetCycleCount(void) {
+    return PortGetCycleCount();
+}
+
+#endif //KTOS_CLOCK_H
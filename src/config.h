@@ -7,16 +7,109 @@
 #ifndef KTOS_CONF_H
 #define KTOS_CONF_H
 
-#define SYSTICK_FREQUENCY_HZ 1000
-#define SYSTICK_INTERVAL_MS 1000 / SYSTICK_FREQUENCY_HZ  // Please make sure that SYSTICK_INTERVAL_MS is an interger.
+// Port of the kernel, 0 for the Cortex-M3, 1 for the host simulation built by `make sim`.
+#ifndef PORT_POSIX
+#define PORT_POSIX 0
+#endif
+#define PORT_POSIX_TICK_US 1000         // host CPU time between the ticks of busy tasks, 0 to only tick when idle.
+#define PORT_POSIX_STACK_EXTRA 16384    // added to each task stack for the host frames.
+
+// Kernel time base, all of the sleeps and timeouts are counted in ticks of this rate.
+#define SYSTICK_FREQUENCY_HZ 1000   // Please make sure that it is a multiple of 1000 and a divisor of 1000000.
+#define SYSTICK_INTERVAL_US (1000000 / SYSTICK_FREQUENCY_HZ)
+#define TICKS_PER_MS (SYSTICK_FREQUENCY_HZ / 1000)
+
+// Use TIM2 as a one-shot timer for the waits shorter than one tick.
+#define USE_TIM2_ONE_SHOT 0
 
 #define MAX_TASKS_COUNT 10
-#define TASK_NAME_SIZE 20
+
+// Fill the task stacks with a pattern when created, the idle task scans how deep each one has been used.
+#define USE_STACK_PAINTING 1
+#define STACK_PAINT_PATTERN 0xa5a5a5a5
+#define STACK_SCAN_WORDS 64     // words of stack checked by each pass of the idle task.
+// Check a canary at the far end of the stack of the task switched out, StackOverflowHook is called if it is lost.
+#define USE_STACK_CHECK 1
+#define STACK_CANARY 0x5a17c0de
+// Per-task bump allocator, from a block taken at TaskCreateWithArena and freed whole by TaskKill.
+#define USE_TASK_ARENA 1
 
 #define QUEUE_SIZE 1
-#define MAX_QUEUE_CONTROL_BLOCK_COUNT 5
+#define MAX_QUEUE_CONTROL_BLOCK_COUNT 5 // preallocated, more are taken from the heap as needed.
+#define QUEUE_SLAB_OBJECTS 4            // queue control blocks per slab, 0 to have no more than the preallocated.
+
+// The ones wrapped by #ifndef could be overridden with -D by build variants (e.g. the benchmarks).
+// Kernel heap. On the Cortex-M3 it takes all of the RAM left between .bss and the main stack
+// reservation (_ktos_heap_start/_end in stm32_sections.ld), and MEM_POOL_SIZE is only its upper
+// bound, which sizes the free list index. The host simulation has a static pool of MEM_POOL_SIZE.
+#define USE_LINKER_HEAP (!PORT_POSIX)
+#ifndef MEM_POOL_SIZE
+#define MEM_POOL_SIZE 20480
+#endif
+// Free lists of the TLSF heap per power of 2, as a power of 2.
+#define HEAP_SL_INDEX_COUNT_LOG2 3
+// malloc, calloc, realloc and free over the kernel heap, counted per task.
+//   off in the host simulation, where they would replace the ones of the host.
+#ifndef USE_KERNEL_MALLOC
+#define USE_KERNEL_MALLOC (!PORT_POSIX)
+#endif
+
+// Per-task CPU time, counted with the DWT cycle counter on every context switch.
+#define USE_RUNTIME_STATS 1
+#define USE_ISR_TIME_STATS 0    // ISRs bracketed by IsrEnter/IsrExit are not charged to tasks.
+#define RUNTIME_STATS_WINDOW_MS 1000
+
+// Latency histograms in DWT cycles, this adds two cycle counter reads to each critical region.
+#define USE_LATENCY_STATS 0
+#define HISTOGRAM_BUCKETS 20
+// Keep the worst critical regions per call site of EnterCritical.
+#define USE_CRITICAL_PROFILER 0
+#define CRITICAL_PROFILER_SITES 8
+
+// Statistical PC sampling on TIM3, decoded by tools/pcprof.py.
+#define USE_PROFILER 0
+#define PROFILER_RATE_HZ 997    // prime, so that the samples do not lock to the tick.
+#define PROFILER_BUFFER_SIZE 512    // must be a power of 2.
+
+// Binary event trace in a RAM ring buffer, decoded by tools/trace2chrome.py.
+#define USE_TRACE 0
+#define TRACE_BUFFER_SIZE 512   // records of 8 bytes, must be a power of 2.
+
+// Logging through per-task buffers, drained by a low priority task.
+#ifndef USE_LOG
+#define USE_LOG 1
+#endif
+#define LOG_SINK_ITM 1  // ITM stimulus port 0 (SWO)
+#define LOG_SINK_UART 2 // USART1 TX on PA9
+#define LOG_SINK_STDOUT 3   // stdout of the host simulation
+#define LOG_SINK LOG_SINK_ITM
+#define LOG_UART_BAUD 115200
+#define LOG_BUFFER_SIZE 64  // bytes per task, must be a power of 2.
+#define LOG_LINE_SIZE 64
+#define LOG_TASK_PRIORITY 0xfe
+#define LOG_TASK_STACK_SIZE 256
+#define LOG_DRAIN_INTERVAL_MS 10
+
+// Deferred binary logging by LOGB, decoded on the host by tools/binlog.py.
+#ifndef USE_BINLOG
+#define USE_BINLOG 1
+#endif
+#define BINLOG_BUFFER_WORDS 256 // must be a power of 2.
+
+#define MAX_BLOCK_POOL_COUNT 4
 
-#define MEM_POOL_SIZE 16000
+#define TIMER_SLAB_OBJECTS 4      // timers per slab, the first slab is static and the others are taken from the heap.
+#define TIMER_DAEMON_PRIORITY 1
+#define TIMER_DAEMON_STACK_SIZE 512
 
+// The host simulation has none of the STM32 peripherals.
+#if PORT_POSIX
+#undef USE_TIM2_ONE_SHOT
+#define USE_TIM2_ONE_SHOT 0
+#undef USE_PROFILER
+#define USE_PROFILER 0
+#undef LOG_SINK
+#define LOG_SINK LOG_SINK_STDOUT
+#endif
 
 #endif //KTOS_CONF_H
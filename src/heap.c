@@ -1,77 +1,327 @@
 //
-// config.h @ ktOS
+// heap.c @ ktOS
 //
 // Created by Kotorinyanya.
 //
+// Two-Level Segregated Fit allocator over mem_pool, which is laid out by the linker
+//   or is a static array, see USE_LINKER_HEAP.
+//   The free blocks are kept in lists by size class: the first level splits the
+//   sizes by powers of 2, the second level splits each power of 2 into
+//   SL_INDEX_COUNT classes. A bitmap of the non-empty lists on each level lets
+//   a fitting list be found with two bit scans, so that both allocation and
+//   free take constant time. A freed block is merged with its free neighbours
+//   at once, the blocks are linked physically by prev_physical and their size.
+//
 
 #include "heap.h"
+#include "ktos.h"
+
+#define ALIGN_SIZE_LOG2 3
+#define ALIGN_SIZE (1 << ALIGN_SIZE_LOG2)
+
+#define SL_INDEX_COUNT_LOG2 HEAP_SL_INDEX_COUNT_LOG2
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+// Sizes below SMALL_BLOCK_SIZE all go to the first level 0, ALIGN_SIZE apart.
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2)
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+// The blocks are smaller than 2^FL_INDEX_MAX, as the pool is.
+#define FL_INDEX_MAX (32 - __builtin_clz(MEM_POOL_SIZE))
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+
+// A free block has to hold its links.
+#define MIN_BLOCK_SIZE ((sizeof(mem_free_links_t) + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1))
+
+_Static_assert(HEADER_SIZE % ALIGN_SIZE == 0, "the payloads would not be aligned");
+_Static_assert(SL_INDEX_COUNT <= 32, "the second level bitmaps are 32-bit");
+
+#if USE_LINKER_HEAP
+// The RAM left for the heap, aligned to 8 bytes by stm32_sections.ld.
+extern char _ktos_heap_start[];
+extern char _ktos_heap_end[];
+#else
+static char mem_pool_area[MEM_POOL_SIZE] __attribute__((aligned(ALIGN_SIZE)));
+#endif
+static char *mem_pool = NULL;
+static uint32_t mem_pool_size = 0;
+
+static uint8_t is_heap_ready = 0;
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[FL_INDEX_COUNT];
+static mem_block_header_t *free_lists[FL_INDEX_COUNT][SL_INDEX_COUNT];
+// Running counters of GetHeapStats.
+static uint32_t used_bytes = 0;
+static uint32_t used_count = 0;
+static uint32_t free_bytes = 0;
+static uint32_t free_count = 0;
+static uint32_t min_free_bytes = 0;
+static uint32_t failed_count = 0;
+
+
+// Index of the highest and of the lowest set bit, x must not be 0.
+static inline uint32_t FindLastSet(uint32_t x) {
+    return 31 - __builtin_clz(x);
+}
+
+static inline uint32_t FindFirstSet(uint32_t x) {
+    return __builtin_ctz(x);
+}
+
+static inline mem_free_links_t *GetLinks(mem_block_header_t *this_block) {
+    return (mem_free_links_t *) ((uintptr_t) this_block + HEADER_SIZE);
+}
+
+static inline mem_block_header_t *GetNextPhysical(mem_block_header_t *this_block) {
+    return (mem_block_header_t *) ((uintptr_t) this_block + HEADER_SIZE + this_block->size);
+}
+
+// The list the block of this size belongs to.
+static void MappingInsert(uint32_t size, uint32_t *fl, uint32_t *sl) {
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size >> ALIGN_SIZE_LOG2;
+    } else {
+        uint32_t last_set = FindLastSet(size);
+        *sl = (size >> (last_set - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = last_set - FL_INDEX_SHIFT + 1;
+    }
+}
 
-static char mem_pool[MEM_POOL_SIZE];
-
-mem_block_header_t *RequestFreeBlock(uint32_t size) {
-    
-    uint32_t available_size;
-    mem_block_header_t *this_block;
-    mem_block_header_t *last_block;
-    
-    //if there is enough space between two blocks inside the chain.
-    mem_block_header_t *this_block_i = (mem_block_header_t *) mem_pool;
-    while (this_block_i->next_block != NULL) {
-        available_size =
-                (uint32_t) (this_block_i->next_block) - (uint32_t) (this_block_i) - this_block_i->size - HEADER_SIZE;
-        if (available_size >= size) {
-            last_block = this_block_i;
-            this_block = (struct _mem_block_header_t *) ((uint32_t) last_block + HEADER_SIZE + last_block->size);
-            this_block->next_block = last_block->next_block;
-            this_block->past_block = last_block;
-            this_block->past_block->next_block = this_block;
-            return this_block;
+// The first list whose blocks are all large enough for this size:
+//   the size is rounded up to the next class before mapping.
+static void MappingSearch(uint32_t size, uint32_t *fl, uint32_t *sl) {
+    if (size >= SMALL_BLOCK_SIZE) {
+        size += (1 << (FindLastSet(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    MappingInsert(size, fl, sl);
+}
+
+static mem_block_header_t *FindSuitableBlock(uint32_t *fl, uint32_t *sl) {
+    if (*fl >= FL_INDEX_COUNT) {
+        return NULL;
+    }
+
+    // A larger class on the same first level, or else on the next first level.
+    uint32_t sl_map = sl_bitmap[*fl] & (~0U << *sl);
+    if (!sl_map) {
+        uint32_t fl_map = fl_bitmap & (~0U << (*fl + 1));
+        if (!fl_map) {
+            return NULL;
         }
-        this_block_i = this_block_i->next_block;
-    }
-    
-    this_block = this_block_i;
-    
-    //if there is enough space on the 'top'.
-    available_size = (uint32_t) (mem_pool + MEM_POOL_SIZE) - (uint32_t) this_block -
-                     HEADER_SIZE * 2;//with one additionally new header for linking.
-    if (available_size >= size) {
-        this_block->size = size;
-        if (this_block->past_block != NULL) { //deal with initial block.
-            this_block->past_block->next_block = this_block;
+        *fl = FindFirstSet(fl_map);
+        sl_map = sl_bitmap[*fl];
+    }
+    *sl = FindFirstSet(sl_map);
+    return free_lists[*fl][*sl];
+}
+
+static void InsertFreeBlock(mem_block_header_t *this_block) {
+    uint32_t fl, sl;
+    MappingInsert(this_block->size, &fl, &sl);
+
+    mem_block_header_t *head = free_lists[fl][sl];
+    mem_free_links_t *links = GetLinks(this_block);
+    links->next_free = head;
+    links->past_free = NULL;
+    if (head != NULL) {
+        GetLinks(head)->past_free = this_block;
+    }
+    free_lists[fl][sl] = this_block;
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+    this_block->is_free = 1;
+    this_block->owner = MEM_BLOCK_NO_OWNER;
+    free_bytes += this_block->size;
+    free_count++;
+}
+
+static void RemoveFreeBlock(mem_block_header_t *this_block) {
+    uint32_t fl, sl;
+    MappingInsert(this_block->size, &fl, &sl);
+
+    mem_free_links_t *links = GetLinks(this_block);
+    if (links->next_free != NULL) {
+        GetLinks(links->next_free)->past_free = links->past_free;
+    }
+    if (links->past_free != NULL) {
+        GetLinks(links->past_free)->next_free = links->next_free;
+    } else {
+        free_lists[fl][sl] = links->next_free;
+        if (links->next_free == NULL) {
+            sl_bitmap[fl] &= ~(1U << sl);
+            if (!sl_bitmap[fl]) {
+                fl_bitmap &= ~(1U << fl);
+            }
         }
-        this_block->next_block = (struct _mem_block_header_t *) ((uint32_t) (this_block) + HEADER_SIZE +
-                                                                 this_block->size); //create a empty block just for linking.
-        this_block->next_block->past_block = this_block;
-        return this_block;
     }
-    
-    return NULL;
+    this_block->is_free = 0;
+    free_bytes -= this_block->size;
+    free_count--;
 }
 
+// The whole pool as one free block, closed by an empty block that is never freed,
+//   so that each block has a block after it.
+static void InitHeap(void) {
+#if USE_LINKER_HEAP
+    mem_pool = _ktos_heap_start;
+    mem_pool_size = (uint32_t) (_ktos_heap_end - _ktos_heap_start);
+    // The free list index does not reach past MEM_POOL_SIZE.
+    if (mem_pool_size > MEM_POOL_SIZE) {
+        mem_pool_size = MEM_POOL_SIZE;
+    }
+#else
+    mem_pool = mem_pool_area;
+    mem_pool_size = MEM_POOL_SIZE;
+#endif
+
+    mem_block_header_t *first_block = (mem_block_header_t *) mem_pool;
+    first_block->prev_physical = NULL;
+    first_block->size = (mem_pool_size - 2 * HEADER_SIZE) & ~(ALIGN_SIZE - 1);
 
+    mem_block_header_t *last_block = GetNextPhysical(first_block);
+    last_block->prev_physical = first_block;
+    last_block->size = 0;
+    last_block->is_free = 0;
+
+    InsertFreeBlock(first_block);
+    min_free_bytes = free_bytes;
+    is_heap_ready = 1;
+}
+
+// Must be called inside a critical region, as FreeMemBlock.
 struct _mem_block_header_t *AllocateMemBlock(uint32_t size) {
-    
+    if (!is_heap_ready) {
+        InitHeap();
+    }
+    if (size > mem_pool_size) {
+        failed_count++;
+        return NULL;
+    }
+
     //re-align stack size to 8 bytes.
     size = Align(size);
-    
-    mem_block_header_t *mem_block = RequestFreeBlock(size);
-    if (mem_block != NULL) {
-        mem_block->size = size;
-        mem_block->stack_bottom = (uint32_t *) ((uint32_t) mem_block + HEADER_SIZE + mem_block->size) - 1;
-        return mem_block;
-    } else {
-        return NULL;
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
     }
-    
-}
 
+    uint32_t fl, sl;
+    MappingSearch(size, &fl, &sl);
+    mem_block_header_t *this_block = FindSuitableBlock(&fl, &sl);
+    if (this_block == NULL) {
+        // The class of the size itself may still hold a block that fits,
+        //   only its first block is tried to keep this in constant time.
+        MappingInsert(size, &fl, &sl);
+        this_block = fl < FL_INDEX_COUNT ? free_lists[fl][sl] : NULL;
+        if (this_block == NULL || this_block->size < size) {
+            failed_count++;
+            return NULL;
+        }
+    }
+    RemoveFreeBlock(this_block);
+
+    // Give the rest back as a free block, if it could make one.
+    if (this_block->size >= size + HEADER_SIZE + MIN_BLOCK_SIZE) {
+        mem_block_header_t *rest = (mem_block_header_t *) ((uintptr_t) this_block + HEADER_SIZE + size);
+        rest->prev_physical = this_block;
+        rest->size = this_block->size - size - HEADER_SIZE;
+        GetNextPhysical(rest)->prev_physical = rest;
+        this_block->size = size;
+        InsertFreeBlock(rest);
+    }
+
+    this_block->stack_bottom = (uint32_t *) ((uintptr_t) this_block + HEADER_SIZE + this_block->size) - 1;
+    this_block->owner = MEM_BLOCK_NO_OWNER;
+    this_block->owner_generation = 0;
+    used_bytes += this_block->size;
+    used_count++;
+    if (free_bytes < min_free_bytes) {
+        min_free_bytes = free_bytes;
+    }
+    return this_block;
+}
 
 void FreeMemBlock(struct _mem_block_header_t *this_block) {
-    this_block->past_block->next_block = this_block->next_block;
-    this_block = NULL;
+    mem_block_header_t *prev_block = this_block->prev_physical;
+    mem_block_header_t *next_block = GetNextPhysical(this_block);
+    used_bytes -= this_block->size;
+    used_count--;
+
+    // Merge with the free neighbours.
+    if (prev_block != NULL && prev_block->is_free) {
+        RemoveFreeBlock(prev_block);
+        prev_block->size += HEADER_SIZE + this_block->size;
+        this_block = prev_block;
+    }
+    if (next_block->is_free) {
+        RemoveFreeBlock(next_block);
+        this_block->size += HEADER_SIZE + next_block->size;
+    }
+    GetNextPhysical(this_block)->prev_physical = this_block;
+
+    InsertFreeBlock(this_block);
 }
 
+// Round the size up to a multiple of 8 bytes.
 uint32_t Align(uint32_t size) {
-    return (size / 8) * 8;
-}
\ No newline at end of file
+    return (size + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1);
+}
+
+// Bytes of RAM given to the heap, headers included.
+uint32_t GetHeapSize(void) {
+    EnterCritical();
+    if (!is_heap_ready) {
+        InitHeap();
+    }
+    LeaveCritical();
+    return mem_pool_size;
+}
+
+// The counters are kept up to date by the heap, only the largest free block is looked for:
+//   it is in the highest free list, which is walked.
+void GetHeapStats(struct _heap_stats_t *stats) {
+    EnterCritical();
+    if (!is_heap_ready) {
+        InitHeap();
+    }
+    stats->used_bytes = used_bytes;
+    stats->free_bytes = free_bytes;
+    stats->min_free_bytes = min_free_bytes;
+    stats->used_count = used_count;
+    stats->free_count = free_count;
+    stats->failed_count = failed_count;
+
+    stats->largest_free = 0;
+    if (fl_bitmap) {
+        uint32_t fl = FindLastSet(fl_bitmap);
+        mem_block_header_t *this_block = free_lists[fl][FindLastSet(sl_bitmap[fl])];
+        for (; this_block != NULL; this_block = GetLinks(this_block)->next_free) {
+            if (this_block->size > stats->largest_free) {
+                stats->largest_free = this_block->size;
+            }
+        }
+    }
+    LeaveCritical();
+}
+
+// Copy out up to max_count blocks in address order, and return how many there are in all.
+//   the whole pool is walked in one critical region, it is meant for debugging.
+uint32_t GetHeapBlocks(struct _heap_block_info_t *blocks, uint32_t max_count) {
+    uint32_t count = 0;
+
+    EnterCritical();
+    if (!is_heap_ready) {
+        InitHeap();
+    }
+    mem_block_header_t *this_block = (mem_block_header_t *) mem_pool;
+    // The empty block closes the pool.
+    for (; this_block->size != 0; this_block = GetNextPhysical(this_block)) {
+        if (count < max_count) {
+            blocks[count].offset = (uint32_t) ((char *) this_block - mem_pool);
+            blocks[count].size = this_block->size;
+            blocks[count].is_free = this_block->is_free;
+            blocks[count].owner = this_block->owner;
+        }
+        count++;
+    }
+    LeaveCritical();
+    return count;
+}
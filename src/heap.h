@@ -1,5 +1,5 @@
 //
-// config.h @ ktOS
+// heap.h @ ktOS
 //
 // Created by Kotorinyanya.
 //
@@ -10,10 +10,20 @@
 #include "types.h"
 #include "config.h"
 
+// Defined in types.h, which includes this header before them.
+struct _heap_stats_t;
+struct _heap_block_info_t;
+
 struct _mem_block_header_t * AllocateMemBlock(uint32_t size);
 
 void FreeMemBlock(struct _mem_block_header_t *this_block);
 
 uint32_t Align(uint32_t size);
 
+uint32_t GetHeapSize(void);
+
+void GetHeapStats(struct _heap_stats_t *stats);
+
+uint32_t GetHeapBlocks(struct _heap_block_info_t *blocks, uint32_t max_count);
+
 #endif //KOTS_HEAP_H
\ No newline at end of file
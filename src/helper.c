@@ -6,6 +6,7 @@
 
 #include "helper.h"
 
+#if !PORT_HAS_LIBC
 void *memset(void *destination, int value, uint32_t n) {
     const unsigned char v = (unsigned char) value;
     unsigned char *dst;
@@ -29,4 +30,86 @@ char *strcpy(char *destination, const char *source) {
     }
     *destination = '\0';
     return rt;
-}
\ No newline at end of file
+}
+#endif
+
+static uint32_t FormatNumber(char *destination, uint32_t size, uint32_t length,
+                             uint32_t value, uint32_t base, uint8_t negative) {
+    char digits[11];
+    uint32_t n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value);
+    if (negative) {
+        digits[n++] = '-';
+    }
+    while (n--) {
+        if (length < size - 1) {
+            destination[length] = digits[n];
+        }
+        length++;
+    }
+    return length;
+}
+
+// A small subset of vsnprintf: %d %u %x %c %s and %%, without width nor precision.
+//   returns the length of the formatted string, which might be longer than size - 1.
+uint32_t FormatString(char *destination, uint32_t size, const char *format, va_list args) {
+    uint32_t length = 0;
+    const char *string;
+    int32_t value;
+    
+    if (size == 0) {
+        return 0;
+    }
+    
+    for (; *format != '\0'; format++) {
+        if (*format != '%') {
+            if (length < size - 1) {
+                destination[length] = *format;
+            }
+            length++;
+            continue;
+        }
+        
+        switch (*++format) {
+            case 'd':
+                value = va_arg(args, int32_t);
+                length = FormatNumber(destination, size, length,
+                                      value < 0 ? -(uint32_t) value : (uint32_t) value, 10, value < 0);
+                break;
+            case 'u':
+                length = FormatNumber(destination, size, length, va_arg(args, uint32_t), 10, 0);
+                break;
+            case 'x':
+                length = FormatNumber(destination, size, length, va_arg(args, uint32_t), 16, 0);
+                break;
+            case 'c':
+                if (length < size - 1) {
+                    destination[length] = (char) va_arg(args, int);
+                }
+                length++;
+                break;
+            case 's':
+                for (string = va_arg(args, const char *); *string != '\0'; string++) {
+                    if (length < size - 1) {
+                        destination[length] = *string;
+                    }
+                    length++;
+                }
+                break;
+            case '\0':
+                format--;
+                break;
+            default:
+                if (length < size - 1) {
+                    destination[length] = *format;
+                }
+                length++;
+        }
+    }
+    
+    destination[length < size - 1 ? length : size - 1] = '\0';
+    return length;
+}
@@ -7,12 +7,24 @@
 #ifndef KTOS_HELPER_H
 #define KTOS_HELPER_H
 
+#include <stdarg.h>
 #include "types.h"
 
+#if PORT_HAS_LIBC
+#include <string.h>
+#else
 void *memset(void *destination, int value, uint32_t n);
 
 void *memcpy(void *dest, const void *src, uint32_t len);
 
 char *strcpy(char *destination, const char *source);
+#endif
+
+// Number of the exception being handled, 0 in thread mode.
+static inline uint32_t GetExceptionNumber(void) {
+    return PortGetExceptionNumber();
+}
+
+uint32_t FormatString(char *destination, uint32_t size, const char *format, va_list args);
 
 #endif //KTOS_HELPER_H
\ No newline at end of file
@@ -5,113 +5,254 @@
 //
 
 #include "ktos.h"
-#include "../CMSIS/CM3/CoreSupport/core_cm3.h"
 
-// Queue control block.
-static queue_control_block_t queue_control_blocks[MAX_QUEUE_CONTROL_BLOCK_COUNT];
+// Queue control block, preallocated for the first ones, the others are taken from slabs of the heap.
+//   a queue is created by the first send to its id, and kept in the active list from then on.
+static uint64_t queue_control_blocks[SLAB_BUFFER_SIZE(sizeof(queue_control_block_t), MAX_QUEUE_CONTROL_BLOCK_COUNT) / 8];
+static slab_cache_t queue_cache;
+// Queue control blocks in use, indexed by queue id.
+static queue_control_block_t *queue_table[QUEUE_CONTROL_BLOCK_NOT_BEING_USED];
 // Task control block.
 static task_control_block_t task_control_blocks[MAX_TASKS_COUNT];
+_Static_assert(__builtin_offsetof(task_control_block_t, stack_top) == 0
+               && __builtin_offsetof(task_control_block_t, queue_id) == sizeof(uint32_t *) + 2 * sizeof(uint32_t) + 3,
+               "the scheduling fields must stay packed at the head of the task control block");
+_Static_assert(MAX_TASKS_COUNT <= 32, "the live tasks are kept in a 32-bit bitmap");
 // Task var.
-static uint8_t task_count = 0;
+//   the killed task control blocks go back to the free list, and are taken again by the next create.
+//   the scans of the tick and the context switch only walk the bits of the live tasks.
+static task_control_block_t *free_tasks = NULL;
+static uint32_t live_tasks = 0;
 static uint8_t current_task = 0;
 // OS var.
-static uint32_t systicks = 0;
-static uint8_t is_os_started = 0;
+static volatile uint32_t systicks = 0;
+static volatile uint32_t systicks_high = 0; // counts the wrap-arounds of systicks.
+static volatile uint8_t is_os_started = 0;
+// Blocked tasks var.
+static uint32_t next_wake_tick = 0;     // earliest wake_time of the blocked tasks
+static uint8_t queue_waiting_count = 0; // tasks that have to be polled by SysTick_Handler
+static uint32_t wake_passes_saved = 0;  // wake ups merged into one scan by the slack
+// Timer var.
+static uint8_t timer_daemon_pid = (uint8_t) -1;
+static uint8_t idle_task_pid = (uint8_t) -1;
+#if USE_STACK_PAINTING
+static uint8_t stack_scan_task = 0; // the task the idle task is scanning the stack of
+#endif
+#if USE_RUNTIME_STATS
+// Runtime stats var, all in DWT cycles.
+static uint32_t slice_start_cycles = 0;  // when the running task was switched in
+static uint32_t window_start_cycles = 0; // when the current window began
+static uint32_t window_end_tick = 0;
+#if USE_ISR_TIME_STATS
+static uint8_t isr_depth = 0;
+static uint32_t isr_start_cycles = 0;
+static uint32_t isr_cycles_in_slice = 0; // ISR time to be taken off the running task
+static uint32_t isr_window_start_cycles = 0;
+static uint16_t isr_usage = 0;
+static uint64_t isr_cycles = 0;
+#endif
+#endif
 
 
 // Queue methods
 void InitQueueControlBlock(void) {
-    queue_control_block_t *this_qcb;
-    for (int i = 0; i < MAX_QUEUE_CONTROL_BLOCK_COUNT; i++) {
-        this_qcb = queue_control_blocks + i;
-        this_qcb->id = QUEUE_CONTROL_BLOCK_NOT_BEING_USED; //set all queue block id to 255 at initial state.
-        for (int j = 0; j < QUEUE_SIZE; j++) {
-            this_qcb->queues[j].status = QUEUE_EMPTY;
-            this_qcb->queues[j].item_ptr = NULL;
-        }
+    SlabCacheInit(&queue_cache, sizeof(queue_control_block_t), QUEUE_SLAB_OBJECTS,
+                  queue_control_blocks, MAX_QUEUE_CONTROL_BLOCK_COUNT);
+    for (int i = 0; i < QUEUE_CONTROL_BLOCK_NOT_BEING_USED; i++) {
+        queue_table[i] = NULL;
     }
 }
 
+static queue_control_block_t *FindQueueControlBlock(uint8_t queue_id) {
+    if (queue_id >= QUEUE_CONTROL_BLOCK_NOT_BEING_USED) {
+        return NULL;
+    }
+    return queue_table[queue_id];
+}
 
+// Only looks the queue up, so that it could be called by the tick.
 static queue_t *GetEmptyQueueBlock(uint8_t queue_id) {
-    queue_control_block_t *this_qcb;
+    queue_control_block_t *this_qcb = FindQueueControlBlock(queue_id);
+    if (this_qcb == NULL) {
+        return NULL;
+    }
+
     queue_t *this_queue;
-    
-    //Try to find the queue with the specified id.
-    for (int i = 0; i < MAX_QUEUE_CONTROL_BLOCK_COUNT; i++) {
-        this_qcb = queue_control_blocks + i;
-        if (this_qcb->id == queue_id) {
-            for (int j = 0; j < QUEUE_SIZE; j++) {
-                this_queue = this_qcb->queues + j;
-                if (this_queue->status == QUEUE_EMPTY) { //check if the queue has empty blocks
-                    return this_queue;
-                }
-            }
-            return NULL;
+    for (int j = 0; j < QUEUE_SIZE; j++) {
+        this_queue = this_qcb->queues + j;
+        if (this_queue->status == QUEUE_EMPTY) { //check if the queue has empty blocks
+            return this_queue;
         }
     }
-    //Try to create a new queue with the specified id.
-    for (int i = 0; i < MAX_QUEUE_CONTROL_BLOCK_COUNT; i++) {
-        this_qcb = queue_control_blocks + i;
-        if (this_qcb->id == QUEUE_CONTROL_BLOCK_NOT_BEING_USED) {
-            this_qcb->id = queue_id;
-            for (int j = 0; j < QUEUE_SIZE; j++) {
-                this_queue = this_qcb->queues + j;
-                if (this_queue->status == QUEUE_EMPTY) { //check if the queue has empty blocks
-                    return this_queue;
-                }
-            }
+    return NULL;
+}
+
+// Create the queue on its first send, only called by the send syscall.
+static queue_t *GetOrCreateEmptyQueueBlock(uint8_t queue_id) {
+    if (queue_id >= QUEUE_CONTROL_BLOCK_NOT_BEING_USED) {
+        return NULL;
+    }
+    if (queue_table[queue_id] == NULL) {
+        queue_control_block_t *this_qcb = SlabAlloc(&queue_cache);
+        if (this_qcb == NULL) {
             return NULL;
         }
+        this_qcb->id = queue_id;
+        for (int j = 0; j < QUEUE_SIZE; j++) {
+            this_qcb->queues[j].status = QUEUE_EMPTY;
+            this_qcb->queues[j].item_ptr = NULL;
+        }
+        queue_table[queue_id] = this_qcb;
     }
-    
-    return NULL;
+    return GetEmptyQueueBlock(queue_id);
 }
 
 static queue_t *GetFilledQueueBlock(uint8_t queue_id) {
-    queue_control_block_t *this_qcb;
-    
-    //Try to find the queue with the specified id.
-    for (int i = 0; i < MAX_QUEUE_CONTROL_BLOCK_COUNT; i++) {
-        this_qcb = queue_control_blocks + i;
-        if (this_qcb->id == queue_id) {
-            queue_t *this_queue;
-            for (int j = 0; j < QUEUE_SIZE; j++) {
-                this_queue = this_qcb->queues + j;
-                if (this_queue->status == QUEUE_FILLED) {
-                    return this_queue;
-                }
-            }
-            return NULL;
+    queue_control_block_t *this_qcb = FindQueueControlBlock(queue_id);
+    if (this_qcb == NULL) {
+        return NULL;
+    }
+
+    queue_t *this_queue;
+    for (int j = 0; j < QUEUE_SIZE; j++) {
+        this_queue = this_qcb->queues + j;
+        if (this_queue->status == QUEUE_FILLED) {
+            return this_queue;
         }
     }
     return NULL;
 }
 
+void QueueGetSlabStats(slab_stats_t *stats) {
+    SlabCacheGetStats(&queue_cache, stats);
+}
+
 
 // Yield is to relinquish control of the current task.
-// In this case, PendSV_Handler will be called.
+// In this case, the context switch handler of the port will be called.
 static inline void Yield(void) {
-    SCB->ICSR = SCB_ICSR_PENDSVSET;
+    PortYield();
+}
+
+// The words at the far end of the stack, furthest from stack_bottom.
+//   the first one is the canary if USE_STACK_CHECK is set.
+#if USE_STACK_CHECK
+#define STACK_GUARD_WORDS 1
+#else
+#define STACK_GUARD_WORDS 0
+#endif
+
+static inline uint32_t *GetStackEnd(task_control_block_t *this_task) {
+    return this_task->stack_bottom + 1 - this_task->stack_size / sizeof(uint32_t);
+}
+
+// The live task with the lowest pid above task_pid, wrapping around to the lowest one.
+static inline uint8_t GetNextLiveTask(uint8_t task_pid) {
+    uint32_t above = live_tasks & ~((2U << task_pid) - 1);
+    if (above == 0) {
+        above = live_tasks;
+    }
+    return above ? (uint8_t) __builtin_ctz(above) : 0;
 }
 
+// The task control block of a handle, NULL once the task has been killed.
+//   must be called inside a critical region.
+static task_control_block_t *GetTask(task_handle_t handle) {
+    uint8_t task_pid = TASK_HANDLE_PID(handle);
+    if (task_pid >= MAX_TASKS_COUNT || !(live_tasks & (1U << task_pid))) {
+        return NULL;
+    }
+    task_control_block_t *this_task = task_control_blocks + task_pid;
+    if (TASK_HANDLE(task_pid, this_task->generation) != handle) {
+        return NULL;
+    }
+    return this_task;
+}
+
+#if USE_STACK_PAINTING
+// Check up to STACK_SCAN_WORDS more words of one stack, from the far end towards stack_bottom.
+//   The first word that lost the pattern is the deepest the task has been,
+//   there is no need to look past the high-water mark already found.
+static void ScanStack(void) {
+    EnterCritical();
+    task_control_block_t *this_task = task_control_blocks + stack_scan_task;
+    uint32_t scan = this_task->stack_scan_words;
+    uint8_t done = 1;
+    
+    if (live_tasks & (1U << stack_scan_task)) {
+        uint32_t *stack_end = GetStackEnd(this_task) + STACK_GUARD_WORDS;
+        uint32_t limit = scan + STACK_SCAN_WORDS;
+        if (limit > this_task->stack_free_words) {
+            limit = this_task->stack_free_words;
+        }
+        while (scan < limit && stack_end[scan] == STACK_PAINT_PATTERN) {
+            scan++;
+        }
+        if (scan < limit) {
+            this_task->stack_free_words = scan;
+        } else if (scan < this_task->stack_free_words) {
+            done = 0;
+        }
+    }
+    
+    // Move on to the next task once this stack is done.
+    if (done) {
+        this_task->stack_scan_words = 0;
+        stack_scan_task = GetNextLiveTask(stack_scan_task);
+    } else {
+        this_task->stack_scan_words = scan;
+    }
+    LeaveCritical();
+}
+#endif
+
 // Set the CPU to idle state
 void _IdleTask(void) {
     while (1) {
-        // "wfe" (A.K.A. wait for event)
-        __asm__ ("wfe");
+#if USE_STACK_PAINTING
+        ScanStack();
+#endif
+        PortIdle();
     }
 }
 
 static void InitTicker(void) {
-    SysTick_Config(SystemCoreClock / SYSTICK_FREQUENCY_HZ);
+    InitClock();
+#if USE_TRACE
+    InitTrace();
+#endif
+#if USE_BINLOG
+    InitBinLog();
+#endif
+    PortInitTicker();
+}
+
+
+// Set the tick for the task to wake up at, it could be delayed by up to slack ticks
+// so that the wake ups close to each other are handled in one scan.
+//   must be called inside a critical region.
+static void SetWakeTimeWithSlack(task_control_block_t *this_task, uint32_t timeout, uint32_t slack) {
+    if (timeout == NO_TIMEOUT) {
+        this_task->wake_time = NO_TIMEOUT;
+        return;
+    }
+    
+    uint32_t wake_time = systicks + timeout;
+    if (wake_time == NO_TIMEOUT) { //NO_TIMEOUT is reserved, wake up one tick later.
+        wake_time++;
+    }
+    this_task->wake_time = wake_time;
+    this_task->wake_slack = slack;
     
-    NVIC_SetPriorityGrouping(0);
-    NVIC_SetPriority(SysTick_IRQn, NVIC_EncodePriority(0, 0, 0));
-    NVIC_SetPriority(SVCall_IRQn, NVIC_EncodePriority(0, 1, 0));
-    NVIC_SetPriority(PendSV_IRQn, NVIC_EncodePriority(0, 2, 0));
+    // Scan at the latest tick allowed, the earlier tasks will be woken up together.
+    if (!TimeReached(wake_time + slack, next_wake_tick)) {
+        next_wake_tick = wake_time + slack;
+    }
 }
 
+static inline void SetWakeTime(task_control_block_t *this_task, uint32_t timeout) {
+    SetWakeTimeWithSlack(this_task, timeout, this_task->slack);
+}
 
 static int _ktSvcStartOs(void) {
     if (is_os_started) {
@@ -120,65 +261,206 @@ static int _ktSvcStartOs(void) {
     
     InitTicker();
     
+    // Create the timer daemon, all of the timer callbacks are executed in it.
+    task_handle_t handle;
+    int result = TaskCreateWithArena((TaskFunction) _TimerDaemonTask, 0, TIMER_DAEMON_STACK_SIZE, 0,
+                                     TIMER_DAEMON_PRIORITY, "Timer", &handle);
+    if (result != TASK_OK) {
+        return OS_START_FAILED;
+    }
+    timer_daemon_pid = TASK_HANDLE_PID(handle);
+    
+#if USE_LOG
+    // Create the log task, which drains the log buffers to the sink.
+    result = TaskCreate((TaskFunction) _LogTask, 0, LOG_TASK_STACK_SIZE, LOG_TASK_PRIORITY, "Log");
+    if (result != TASK_OK) {
+        return OS_START_FAILED;
+    }
+#endif
+    
     // Create idle task as the default task.
-    int result = TaskCreate((TaskFunction) _IdleTask, 0, 512, 0xff, "Idle");
+    result = TaskCreateWithArena((TaskFunction) _IdleTask, 0, 512, 0, 0xff, "Idle", &handle);
     if (result != TASK_OK) {
         return OS_START_FAILED;
     }
     
-    // current_task = (uint8_t) (task_count - 1); //the idle task
     // Load idle task, return to thread mode, other tasks will be loaded upon context switch.
-    current_task = task_count - 1;//the idle task.
+    current_task = TASK_HANDLE_PID(handle);//the idle task.
+    idle_task_pid = current_task;
     task_control_block_t *this_tcb = task_control_blocks + current_task;
-    uint32_t stack_top = (uint32_t) this_tcb->stack_top;
-    register int r1 asm("r1") = (int) &is_os_started;
-    register int r2 asm("r2") = 1;
-    __asm__ __volatile__ (
-    R"(
-        ldmia %0!, {r4-r11}
-        msr psp, %0
-        str %2, [%1]
-        ldr pc, =0xFFFFFFFD
-        )"
-    :
-    : "r" (stack_top), "r" (r1), "r" (r2)
-    );
+    PortStartFirstTask(this_tcb->stack_top, &is_os_started);
     
     // Should not be here
     is_os_started = 0;
     return OS_START_FAILED;
 }
 
-static int _ktSvcTaskKill(uint8_t task_pid) {
+// Give the stack, the arena and the task control block of a killed task back,
+//   must be called inside a critical region, once the task is no longer running.
+static void ReleaseTask(task_control_block_t *this_task) {
+    // The stacks of TaskCreateStatic belong to the caller.
+    if (this_task->mem_block != NULL) {
+        FreeMemBlock(this_task->mem_block);
+        this_task->mem_block = NULL;
+    }
+#if USE_TASK_ARENA
+    // All that was allocated from the arena goes at once.
+    if (this_task->arena != NULL) {
+        FreeMemBlock(this_task->arena);
+        this_task->arena = NULL;
+    }
+#endif
+    this_task->next_free = free_tasks;
+    free_tasks = this_task;
+}
+
+// Take the task out of the scheduling, and let its handles go stale.
+//   must be called inside a critical region, the task is released by the caller.
+static void MarkTaskKilled(task_control_block_t *this_task) {
+    if (this_task->status == TASK_STATE_WAIT_TO_SENT_QUEUE
+        || this_task->status == TASK_STATE_WAIT_TO_RECEIVE_QUEUE) {
+        queue_waiting_count--;
+    }
+    this_task->status = TASK_STATE_KILLED;
+    this_task->generation++;
+    live_tasks &= ~(1U << this_task->pid);
+    
+    // The other parts of the kernel that keep the pid let go of it.
+    _BlockPoolForgetTask(this_task->pid);
+#if USE_TIM2_ONE_SHOT
+    _OneShotForgetTask(this_task->pid);
+#endif
+#if USE_KERNEL_MALLOC
+    _HeapForgetTask(this_task->pid);
+#endif
+}
+
+static int _ktSvcTaskKill(task_handle_t handle) {
     EnterCritical();
-    task_control_block_t *this_task = task_control_blocks + task_pid;
+    task_control_block_t *this_task = GetTask(handle);
+    if (this_task == NULL || this_task->pid == idle_task_pid) {
+        LeaveCritical();
+        return TASK_INVALID_HANDLE;
+    }
     
-    this_task->status = TASK_STATE_KILLED;
-    FreeMemBlock(this_task->mem_block);
+    MarkTaskKilled(this_task);
     
+    // The running task is still on its stack, it is released once switched out.
+    if (this_task->pid != current_task) {
+        ReleaseTask(this_task);
+        LeaveCritical();
+        return TASK_OK;
+    }
     LeaveCritical();
     Yield();
-    return 0;
+    return TASK_OK;
 }
 
-static int _ktSvcTaskSleep(uint8_t task_id, uint32_t sleep_time) {
+static int _ktSvcTaskSleep(uint8_t task_id, uint32_t sleep_ticks, uint32_t slack) {
     EnterCritical();
     task_control_block_t *this_task = task_control_blocks + task_id;
     this_task->status = TASK_STATE_DELAYED;
-    this_task->sleep_time = sleep_time;
+    SetWakeTimeWithSlack(this_task, sleep_ticks, slack);
     LeaveCritical();
     Yield();
     return 0;
 }
 
+static int _ktSvcTaskSleepUntil(uint8_t task_id, uint32_t release_tick) {
+    EnterCritical();
+    // Overrun, the release is already due.
+    if (TimeReached(systicks, release_tick)) {
+        LeaveCritical();
+        return SYSCALL_FAILED;
+    }
+    
+    task_control_block_t *this_task = task_control_blocks + task_id;
+    this_task->status = TASK_STATE_DELAYED;
+    SetWakeTimeWithSlack(this_task, release_tick - systicks, 0);
+#if USE_LATENCY_STATS
+    this_task->release_tick = release_tick;
+    this_task->release_pending = 1;
+#endif
+    LeaveCritical();
+    Yield();
+    return SYSCALL_OK;
+}
+
+static int _ktSvcTaskSleepUs(uint8_t task_id, uint32_t sleep_us) {
+#if USE_TIM2_ONE_SHOT
+    // Waits shorter than one tick are woken up by TIM2 if it is not busy.
+    if (sleep_us < SYSTICK_INTERVAL_US) {
+        EnterCritical();
+        if (OneShotStart(sleep_us, task_id)) {
+            task_control_block_t *this_task = task_control_blocks + task_id;
+            this_task->status = TASK_STATE_WAIT_NOTIFY;
+            this_task->wake_time = NO_TIMEOUT;
+            LeaveCritical();
+            Yield();
+            return 0;
+        }
+        LeaveCritical();
+    }
+#endif
+    return _ktSvcTaskSleep(task_id, UsToTicks(sleep_us), 0);
+}
+
+static int _ktSvcTaskNotifyWait(uint8_t task_id, uint32_t timeout) {
+    EnterCritical();
+    task_control_block_t *this_task = task_control_blocks + task_id;
+    
+    // The notification arrived before waiting, consume it and return.
+    if (this_task->notified) {
+        this_task->notified = 0;
+        LeaveCritical();
+        return SYSCALL_OK;
+    }
+    
+    if (timeout == 0) {
+        LeaveCritical();
+        return SYSCALL_FAILED;
+    }
+    
+    this_task->status = TASK_STATE_WAIT_NOTIFY;
+    SetWakeTime(this_task, timeout);
+    LeaveCritical();
+    Yield();
+    return SYSCALL_OK;
+}
+
+// The wait of the kernel objects, as TaskNotifyWait but on a flag of its own,
+//   so that the notifications of the application are not taken by it, nor it by them.
+static int _ktSvcTaskObjectWait(uint8_t task_id, uint32_t timeout) {
+    EnterCritical();
+    task_control_block_t *this_task = task_control_blocks + task_id;
+    
+    if (this_task->object_woken) {
+        this_task->object_woken = 0;
+        LeaveCritical();
+        return SYSCALL_OK;
+    }
+    
+    if (timeout == 0) {
+        LeaveCritical();
+        return SYSCALL_FAILED;
+    }
+    
+    this_task->status = TASK_STATE_WAIT_OBJECT;
+    SetWakeTime(this_task, timeout);
+    LeaveCritical();
+    Yield();
+    return SYSCALL_OK;
+}
+
 static int _ktSvcSendToQueue(uint8_t queue_id, uint32_t item, uint32_t timeout) {
     EnterCritical();
+    TRACE(TRACE_QUEUE_SEND, current_task, queue_id);
     
-    queue_t *this_queue = GetEmptyQueueBlock(queue_id);
+    queue_t *this_queue = GetOrCreateEmptyQueueBlock(queue_id);
     
     // Try to push item to the queue
     if (this_queue != NULL) {
-        this_queue->item_ptr = (uint32_t *) item;
+        this_queue->item_ptr = (uint32_t *) (uintptr_t) item;
         this_queue->status = QUEUE_FILLED;
         LeaveCritical();
         return QUEUE_SENT_OK;
@@ -193,14 +475,16 @@ static int _ktSvcSendToQueue(uint8_t queue_id, uint32_t item, uint32_t timeout)
     // Set the task to wait until timeout
     task_control_block_t *this_task = task_control_blocks + current_task;
     this_task->status = TASK_STATE_WAIT_TO_SENT_QUEUE;
-    this_task->sleep_time = timeout;
+    SetWakeTime(this_task, timeout);
     this_task->queue_id = queue_id;
+    queue_waiting_count++;
+    TRACE(TRACE_QUEUE_BLOCK, current_task, queue_id);
     LeaveCritical();
     Yield();
     
     // The task is ready again, let's try to push item to the queue again
     EnterCritical();
-    this_queue = GetEmptyQueueBlock(queue_id);
+    this_queue = GetOrCreateEmptyQueueBlock(queue_id);
     if (this_queue != NULL) {
         this_queue->item_ptr = &item;
         this_queue->status = QUEUE_FILLED;
@@ -214,12 +498,13 @@ static int _ktSvcSendToQueue(uint8_t queue_id, uint32_t item, uint32_t timeout)
 
 static int _ktSvcReceiveFromQueue(uint8_t queue_id, uint32_t *item_ptr, uint32_t timeout) {
     EnterCritical();
+    TRACE(TRACE_QUEUE_RECEIVE, current_task, queue_id);
     
     queue_t *this_queue = GetFilledQueueBlock(queue_id);
     
     // Try to pull item from the queue
     if (this_queue != NULL) {
-        *item_ptr = this_queue->item_ptr;
+        *item_ptr = (uint32_t) (uintptr_t) this_queue->item_ptr;
         this_queue->status = QUEUE_EMPTY;
         LeaveCritical();
         return QUEUE_RECEIVE_OK;
@@ -234,8 +519,10 @@ static int _ktSvcReceiveFromQueue(uint8_t queue_id, uint32_t *item_ptr, uint32_t
     // Set the task to wait until timeout
     task_control_block_t *this_task = task_control_blocks + current_task;
     this_task->status = TASK_STATE_WAIT_TO_RECEIVE_QUEUE;
-    this_task->sleep_time = timeout;
+    SetWakeTime(this_task, timeout);
     this_task->queue_id = queue_id;
+    queue_waiting_count++;
+    TRACE(TRACE_QUEUE_BLOCK, current_task, queue_id);
     LeaveCritical();
     Yield();
     
@@ -243,7 +530,7 @@ static int _ktSvcReceiveFromQueue(uint8_t queue_id, uint32_t *item_ptr, uint32_t
     EnterCritical();
     this_queue = GetFilledQueueBlock(queue_id);
     if (this_queue != NULL) {
-        *item_ptr = this_queue->item_ptr;
+        *item_ptr = (uint32_t) (uintptr_t) this_queue->item_ptr;
         this_queue->status = QUEUE_EMPTY;
         LeaveCritical();
         return QUEUE_RECEIVE_OK;
@@ -255,132 +542,177 @@ static int _ktSvcReceiveFromQueue(uint8_t queue_id, uint32_t *item_ptr, uint32_t
 
 
 // Supervisor Calls
-//   called by syscall
-void _ktSvcHandler(hardware_stack_frame_t *hw_ctx) {
-    uint8_t service_no = *(uint8_t *) (hw_ctx->pc - 2);
-    if (service_no != 0x80) {
-        return;
-    }
+//   called by the syscall handler of the port.
+int32_t _ktSyscall(uint32_t code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3) {
+    TRACE(TRACE_SYSCALL, current_task, code);
     
-    switch (hw_ctx->r0) {
+    switch (code) {
         case SYSCALL_START_OS:
-            hw_ctx->r0 = _ktSvcStartOs();
-            break;
+            return _ktSvcStartOs();
         case SYSCALL_TASK_KILL:
-            hw_ctx->r0 = _ktSvcTaskKill(hw_ctx->r1);
-            break;
+            return _ktSvcTaskKill(arg1);
         case SYSCALL_TASK_SLEEP:
-            hw_ctx->r0 = _ktSvcTaskSleep(hw_ctx->r1, hw_ctx->r2);
-            break;
+            return _ktSvcTaskSleep(arg1, arg2, arg3);
+        case SYSCALL_TASK_SLEEP_UNTIL:
+            return _ktSvcTaskSleepUntil(arg1, arg2);
+        case SYSCALL_TASK_SLEEP_US:
+            return _ktSvcTaskSleepUs(arg1, arg2);
+        case SYSCALL_TASK_NOTIFY_WAIT:
+            return _ktSvcTaskNotifyWait(arg1, arg2);
+        case SYSCALL_TASK_OBJECT_WAIT:
+            return _ktSvcTaskObjectWait(arg1, arg2);
         case SYSCALL_SEND_TO_QUEUE:
-            hw_ctx->r0 = _ktSvcSendToQueue(hw_ctx->r1, hw_ctx->r2, hw_ctx->r3);
-            break;
+            return _ktSvcSendToQueue(arg1, arg2, arg3);
         case SYSCALL_RECEIVE_FROM_QUEUE:
-            hw_ctx->r0 = _ktSvcReceiveFromQueue(hw_ctx->r1, hw_ctx->r2, hw_ctx->r3);
-            break;
+            return _ktSvcReceiveFromQueue(arg1, (uint32_t *) arg2, arg3);
         default:
-            hw_ctx->r0 = SYSCALL_UNDEFINED;
+            return SYSCALL_UNDEFINED;
     }
 }
 
-__attribute__((naked)) void SVC_Handler(void) {
-    __asm__(
-    R"(
-        tst lr, #4
-        ite eq
-        mrseq r0, msp
-        mrsne r0, psp
+// "syscall" wrapper, the trap itself is done by the port.
+static inline int32_t syscall(uint32_t code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3) {
+    return PortSyscall(code, arg1, arg2, arg3);
+}
+
 
-        push {lr}
-        bl _ktSvcHandler
-        pop {pc}
-        )"
-    );
+#if USE_RUNTIME_STATS
+// Charge the cycles since the last switch to the running task,
+//   must be called inside a critical region or by PendSV_Handler.
+static void AccountRunTime(task_control_block_t *this_task) {
+    uint32_t now = GetCycleCount();
+    uint32_t elapsed = now - slice_start_cycles;
+#if USE_ISR_TIME_STATS
+    // Split the ISR being executed at the end of the slice.
+    if (isr_depth) {
+        isr_cycles += now - isr_start_cycles;
+        isr_cycles_in_slice += now - isr_start_cycles;
+        isr_start_cycles = now;
+    }
+    elapsed -= isr_cycles_in_slice;
+    isr_cycles_in_slice = 0;
+#endif
+    this_task->run_cycles += elapsed;
+    slice_start_cycles = now;
 }
 
-// "syscall" wrapper
-static inline int32_t syscall(int32_t r0, int32_t r1, int32_t r2, int32_t r3) {
-    int32_t result;
-    __asm__ __volatile__ (
-    R"(
-        mov r0, %1
-        mov r1, %2
-        mov r2, %3
-        mov r3, %4
-        svc #0x80
-        mov %0, r0
-        )"
-    : "=r" (result)
-    : "r" (r0), "r" (r1), "r" (r2), "r" (r3)
-    : "r0", "r1", "r2", "r3"
-    );
-    return result;
+// Work out the share of each task in the window just passed, called by SysTick_Handler.
+//   only 32-bit divisions are used, so the window must be shorter than 2^32 cycles.
+static void UpdateCpuUsage(void) {
+    AccountRunTime(task_control_blocks + current_task);
+    uint32_t now = slice_start_cycles;
+    uint32_t unit = (now - window_start_cycles) / 10000;
+    if (unit == 0) {
+        unit = 1;
+    }
+    
+    task_control_block_t *this_task;
+    for (uint32_t live = live_tasks; live; live &= live - 1) {
+        this_task = task_control_blocks + __builtin_ctz(live);
+        this_task->window_usage = (uint16_t) (((uint32_t) this_task->run_cycles - this_task->window_start_run) / unit);
+        this_task->window_start_run = (uint32_t) this_task->run_cycles;
+    }
+#if USE_ISR_TIME_STATS
+    isr_usage = (uint16_t) (((uint32_t) isr_cycles - isr_window_start_cycles) / unit);
+    isr_window_start_cycles = (uint32_t) isr_cycles;
+#endif
+    window_start_cycles = now;
 }
+#endif
 
+#if USE_STACK_CHECK
+// Called by the context switch handler with the task that overflowed its stack,
+//   override it to log or reset. This one stops here for the debugger.
+__attribute__((weak)) void StackOverflowHook(uint8_t task_pid, const char *name) {
+    (void) task_pid;
+    (void) name;
+    while (1);
+}
+#endif
 
 // Context switch methods
-//   called by PendSV_Handler.
-uint32_t _ContextSwitcher(uint32_t stack_top) {
+//   called by the context switch handler of the port (PendSV_Handler).
+uint32_t *_ContextSwitcher(uint32_t *stack_top) {
+#if USE_TRACE
+    uint8_t this_task_pid = current_task;
+#endif
     task_control_block_t *this_task = task_control_blocks + current_task;
     task_control_block_t *next_task = task_control_blocks + current_task;
     
-    // Save the stack pointer passed by r0
-    this_task->stack_top = (uint32_t *) stack_top;
+    // Save the stack pointer passed by the port
+    this_task->stack_top = stack_top;
+    
+    // The task killed itself, and has left its stack now.
+    if (this_task->status == TASK_STATE_KILLED) {
+        EnterCritical();
+        ReleaseTask(this_task);
+        LeaveCritical();
+    }
+#if USE_STACK_CHECK
+    // The task has run past the far end of its stack, and may have broken the heap below it.
+    //   it is not run again, nor are its stack and task control block released.
+    else {
+        uint32_t *stack_end = GetStackEnd(this_task);
+        if (*stack_end != STACK_CANARY || stack_top <= stack_end) {
+            EnterCritical();
+            MarkTaskKilled(this_task);
+            LeaveCritical();
+            StackOverflowHook(current_task, this_task->name);
+        }
+    }
+#endif
+
+#if USE_RUNTIME_STATS
+    AccountRunTime(this_task);
+#endif
     
     if (this_task->status == TASK_STATE_RUNNING) {
         this_task->status = TASK_STATE_READY;
     }
     
-    // Search for the task with highest priority
+    // Search for the task with highest priority,
+    // among the other live tasks, from the one after the current one round.
     uint8_t highest_priority = 0xff;
     uint8_t current_task_i = current_task;
+    uint32_t others = live_tasks & ~(1U << current_task_i);
+    uint32_t rounds[2] = {others & ~((2U << current_task_i) - 1), others & ((1U << current_task_i) - 1)};
     
-    uint8_t i = task_count;
-    // if task_count_i == 1, this loop won't be triggered.
-    while (--i) {
-        current_task_i++;
-        if (current_task_i >= task_count) {
-            current_task_i = 0;
-        }
-        
-        this_task = task_control_blocks + current_task_i;
-        
-        // Switch to the task with highest priority,
-        // if there were multiple tasks at the highest,
-        // switch between the highest ones.
-        if (this_task->status == TASK_STATE_READY
-            && this_task->priority <= highest_priority) {
-            next_task = this_task;
-            current_task = current_task_i;
-            highest_priority = next_task->priority;
+    for (int i = 0; i < 2; i++) {
+        for (uint32_t live = rounds[i]; live; live &= live - 1) {
+            current_task_i = (uint8_t) __builtin_ctz(live);
+            this_task = task_control_blocks + current_task_i;
+            
+            // Switch to the task with highest priority,
+            // if there were multiple tasks at the highest,
+            // switch between the highest ones.
+            if (this_task->status == TASK_STATE_READY
+                && this_task->priority <= highest_priority) {
+                next_task = this_task;
+                current_task = current_task_i;
+                highest_priority = next_task->priority;
+            }
         }
     }
     
     next_task->status = TASK_STATE_RUNNING;
+
+#if USE_LATENCY_STATS
+    if (next_task->ready_cycles) {
+        HistogramAdd(HISTOGRAM_WAKE_LATENCY, GetCycleCount() - next_task->ready_cycles);
+        next_task->ready_cycles = 0;
+    }
+    if (next_task->release_pending) {
+        HistogramAdd(HISTOGRAM_RELEASE_JITTER, GetCyclesSinceTick(next_task->release_tick));
+        next_task->release_pending = 0;
+    }
+#endif
+    TRACE(TRACE_TASK_SWITCH, current_task, this_task_pid);
     
-    // Load the stack pointer back to r0
-    return (uint32_t) next_task->stack_top;
+    // Hand the stack pointer back to the port
+    return next_task->stack_top;
     
 }
 
-// PendSV will be called by Yield every SysTick.
-//   this is to do the context switch
-__attribute__((naked)) void PendSV_Handler(void) {
-    __asm__ __volatile__(
-    R"(
-        push {lr}
-        mrs r0, psp
-        stmdb r0!, {r4-r11}
-
-        bl _ContextSwitcher
-
-        ldmia r0!, {r4-r11}
-        msr psp, r0
-        pop {pc}
-        )"
-    );
-}
-
 int ktOSStart(void) {
     return syscall(SYSCALL_START_OS, 0, 0, 0);
 }
@@ -389,15 +721,112 @@ int ktOSStart(void) {
 
 void InitTaskControlBlock(void) {
     task_control_block_t *this_tcb;
-    for (int i = 0; i < MAX_TASKS_COUNT; i++) {
+    free_tasks = NULL;
+    live_tasks = 0;
+    // Linked from the last one down, so that the pids are handed out in order.
+    for (int i = MAX_TASKS_COUNT - 1; i >= 0; i--) {
         this_tcb = task_control_blocks + i;
-        this_tcb->pid = (uint8_t) -1;
+        this_tcb->pid = (uint8_t) i;
+        this_tcb->generation = 0;
+        this_tcb->mem_block = NULL;
+#if USE_TASK_ARENA
+        this_tcb->arena = NULL;
+#endif
+        this_tcb->next_free = free_tasks;
+        free_tasks = this_tcb;
+        this_tcb->name = "";
         this_tcb->status = TASK_STATE_KILLED;
         this_tcb->priority = (uint8_t) -1;
         this_tcb->queue_id = TASK_WITH_NO_QUEUE;
+        this_tcb->wake_time = NO_TIMEOUT;
+        this_tcb->wake_slack = 0;
+        this_tcb->slack = 0;
+        this_tcb->notified = 0;
+#if USE_RUNTIME_STATS
+        this_tcb->run_cycles = 0;
+        this_tcb->window_start_run = 0;
+        this_tcb->window_usage = 0;
+#endif
+#if USE_LATENCY_STATS
+        this_tcb->ready_cycles = 0;
+        this_tcb->release_pending = 0;
+#endif
+    }
+}
+
+
+// Take a task control block off the free list, NULL if all of them are in use.
+//   must be called inside a critical region.
+static task_control_block_t *GetFreeTaskControlBlock(void) {
+    task_control_block_t *this_task = free_tasks;
+    if (this_task != NULL) {
+        free_tasks = this_task->next_free;
     }
+    return this_task;
 }
 
+// Put back a task control block taken by a create that failed.
+static inline void PutFreeTaskControlBlock(task_control_block_t *this_task) {
+    this_task->next_free = free_tasks;
+    free_tasks = this_task;
+}
+
+// Paint the stack and set its canary, before the task is set up. The stack belongs to the
+//   task being created until then, so this is done without masking the interrupts.
+static void PrepareTaskStack(uint32_t *stack_bottom, uint32_t stack_size) {
+    uint32_t *stack_end = stack_bottom + 1 - stack_size / sizeof(uint32_t);
+    
+    PortPrepareStack(stack_end, stack_size);
+#if USE_STACK_PAINTING
+    for (uint32_t i = STACK_GUARD_WORDS; i < stack_size / sizeof(uint32_t); i++) {
+        stack_end[i] = STACK_PAINT_PATTERN;
+    }
+#endif
+#if USE_STACK_CHECK
+    *stack_end = STACK_CANARY;
+#endif
+}
+
+// Fill in the task control block and the initial frame on its stack prepared by PrepareTaskStack,
+//   must be called inside a critical region.
+static void InitTask(task_control_block_t *this_task, TaskFunction entry, void *arg, uint32_t *stack_bottom,
+                     uint32_t stack_size, uint8_t priority, const char *name, task_handle_t *handle) {
+    this_task->name = name;
+    this_task->priority = priority;
+    this_task->status = TASK_STATE_READY;
+    this_task->wake_time = NO_TIMEOUT;
+    this_task->wake_slack = 0;
+    this_task->slack = 0;
+    this_task->notified = 0;
+    this_task->object_woken = 0;
+#if USE_RUNTIME_STATS
+    this_task->run_cycles = 0;
+    this_task->window_start_run = 0;
+    this_task->window_usage = 0;
+#endif
+#if USE_LATENCY_STATS
+    this_task->ready_cycles = 0;
+    this_task->release_pending = 0;
+#endif
+    this_task->stack_size = stack_size;
+    this_task->stack_bottom = stack_bottom;
+#if USE_TASK_ARENA
+    this_task->arena = NULL;
+    this_task->arena_used = 0;
+#endif
+#if USE_STACK_PAINTING
+    this_task->stack_free_words = stack_size / sizeof(uint32_t) - STACK_GUARD_WORDS;
+    this_task->stack_scan_words = 0;
+#endif
+    
+    // Init stack frame, the task returns to TaskKill.
+    this_task->stack_top = PortInitStack(stack_bottom, stack_size, entry, arg, TaskKill);
+    
+    live_tasks |= 1U << this_task->pid;
+    if (handle != NULL) {
+        *handle = TASK_HANDLE(this_task->pid, this_task->generation);
+    }
+}
 
 int TaskCreate(
         TaskFunction entry,
@@ -405,134 +834,515 @@ int TaskCreate(
         uint32_t stack_size,
         uint8_t priority,
         const char *name
+) {
+    return TaskCreateWithArena(entry, arg, stack_size, 0, priority, name, NULL);
+}
+
+// Create a task with an arena of arena_size bytes taken from the heap along with its stack,
+//   which the task allocates from with ArenaAlloc. An arena_size of 0 gives no arena.
+//   The handle of the task is stored to handle, if it is not NULL.
+int TaskCreateWithArena(
+        TaskFunction entry,
+        void *arg,
+        uint32_t stack_size,
+        uint32_t arena_size,
+        uint8_t priority,
+        const char *name,
+        task_handle_t *handle
 ) {
     EnterCritical();
     
-    // Find a available task control block.
-    task_control_block_t *this_task;
-    for (int i = 0; i < MAX_TASKS_COUNT; i++) {
-        this_task = task_control_blocks + i;
-        if (this_task->status == TASK_STATE_KILLED) {
-            break;
-        }
+    task_control_block_t *this_task = GetFreeTaskControlBlock();
+    if (this_task == NULL) {
+        LeaveCritical();
+        return TASK_AMOUNT_MAXIMUM_EXCEEDED;
     }
     
     // Allocate memory space for stack.
-    this_task->mem_block = AllocateMemBlock(stack_size);
+    this_task->mem_block = AllocateMemBlock(PORT_STACK_SIZE(stack_size));
     if (this_task->mem_block == NULL) {
+        PutFreeTaskControlBlock(this_task);
         LeaveCritical();
         return TASK_ALLOCATE_STACK_FAILED;
     }
     
-    strcpy(this_task->name, name);
-    this_task->pid = task_count++; //task id for operation.
-    this_task->priority = priority;
-    this_task->status = TASK_STATE_READY;
-    this_task->stack_size = stack_size;
-    this_task->stack_bottom = this_task->mem_block->stack_bottom;
-    this_task->stack_top = (uint32_t *) ((uint32_t) this_task->stack_bottom - (16 * sizeof(uint32_t)));
-    
-    // Init stack frame.
-    hardware_stack_frame_t *hardware_stack_frame;
-    hardware_stack_frame = (hardware_stack_frame_t *) ((uint32_t) this_task->stack_bottom - (8 * sizeof(uint32_t)));
-    //memset(hardware_stack_frame, 0, sizeof(hardware_stack_frame));
-    //software_stack_frame_t * software_stack_frame;
-    //software_stack_frame = (software_stack_frame_t*)this_task->stack_top;
-    //memset(software_stack_frame, 0, sizeof(software_stack_frame));
-    
-    hardware_stack_frame->r0 = (uint32_t) arg;
-    hardware_stack_frame->lr = (uint32_t) TaskKill;
-    hardware_stack_frame->pc = (uint32_t) entry;
-    hardware_stack_frame->psr = 0x21000000; //default PSR value
+#if USE_TASK_ARENA
+    mem_block_header_t *arena = NULL;
+    if (arena_size) {
+        arena = AllocateMemBlock(arena_size);
+        if (arena == NULL) {
+            FreeMemBlock(this_task->mem_block);
+            this_task->mem_block = NULL;
+            PutFreeTaskControlBlock(this_task);
+            LeaveCritical();
+            return MEM_POOL_MAXIMUM_EXCEEDED;
+        }
+    }
+#else
+    if (arena_size) {
+        FreeMemBlock(this_task->mem_block);
+        this_task->mem_block = NULL;
+        PutFreeTaskControlBlock(this_task);
+        LeaveCritical();
+        return MEM_POOL_MAXIMUM_EXCEEDED;
+    }
+#endif
+    LeaveCritical();
+    
+    // The control block is taken off the free list but not live yet, and the stack is ours.
+    PrepareTaskStack(this_task->mem_block->stack_bottom, this_task->mem_block->size);
+    
+    EnterCritical();
+    InitTask(this_task, entry, arg, this_task->mem_block->stack_bottom, this_task->mem_block->size,
+             priority, name, handle);
+    this_task->mem_block->owner = this_task->pid;
+#if USE_TASK_ARENA
+    if (arena != NULL) {
+        arena->owner = this_task->pid;
+        this_task->arena = arena;
+    }
+#endif
     
     LeaveCritical();
     return TASK_OK;
     
 }
 
+// Create a task on a stack given by the caller, declared with TASK_STACK_DEFINE,
+//   nothing is taken from the heap. The stack must be 8-byte aligned and is not
+//   touched by the kernel again once the task is killed.
+int TaskCreateStatic(
+        TaskFunction entry,
+        void *arg,
+        uint32_t *stack,
+        uint32_t stack_size,
+        uint8_t priority,
+        const char *name,
+        task_handle_t *handle
+) {
+    stack_size &= ~7U;
+    if (stack == NULL || (uintptr_t) stack % 8 != 0 || stack_size == 0) {
+        return TASK_ALLOCATE_STACK_FAILED;
+    }
+    
+    uint32_t *stack_bottom = stack + stack_size / sizeof(uint32_t) - 1;
+    PrepareTaskStack(stack_bottom, stack_size);
+    
+    EnterCritical();
+    
+    task_control_block_t *this_task = GetFreeTaskControlBlock();
+    if (this_task == NULL) {
+        LeaveCritical();
+        return TASK_AMOUNT_MAXIMUM_EXCEEDED;
+    }
+    
+    this_task->mem_block = NULL;
+    InitTask(this_task, entry, arg, stack_bottom, stack_size, priority, name, handle);
+    
+    LeaveCritical();
+    return TASK_OK;
+}
+
 void TaskKill(void) {
-    syscall(SYSCALL_TASK_KILL, current_task, 0, 0);
+    syscall(SYSCALL_TASK_KILL, GetCurrentTaskHandle(), 0, 0);
+}
+
+// Kill another task, or the current one. Its stack and arena are freed,
+//   and its pid is given to the next task created. The idle task could not be killed.
+int TaskDelete(task_handle_t handle) {
+    return syscall(SYSCALL_TASK_KILL, handle, 0, 0);
+}
+
+// Whether the task of the handle has not been killed yet.
+uint8_t TaskIsAlive(task_handle_t handle) {
+    EnterCritical();
+    uint8_t is_alive = GetTask(handle) != NULL;
+    LeaveCritical();
+    return is_alive;
 }
 
 void TaskSleep(uint32_t sleep_time) {
-    syscall(SYSCALL_TASK_SLEEP, current_task, sleep_time, 0);
+    syscall(SYSCALL_TASK_SLEEP, current_task, MsToTicks(sleep_time), task_control_blocks[current_task].slack);
+}
+
+// Sleep for sleep_time, the wake up could be delayed by up to slack to be merged with others.
+void TaskSleepWithSlack(uint32_t sleep_time, uint32_t slack) {
+    syscall(SYSCALL_TASK_SLEEP, current_task, MsToTicks(sleep_time), MsToTicks(slack));
+}
+
+// Set the default slack of the current task, used by all of its sleeps and timeouts.
+void TaskSetSlack(uint32_t slack) {
+    task_control_blocks[current_task].slack = MsToTicks(slack);
+}
+
+// Sleep until last_wake_tick + period, and move last_wake_tick on to it,
+//   so that a periodic task does not drift. Fails at once on an overrun.
+int TaskSleepUntil(uint32_t *last_wake_tick, uint32_t period) {
+    *last_wake_tick += MsToTicks(period);
+    return syscall(SYSCALL_TASK_SLEEP_UNTIL, current_task, *last_wake_tick, 0);
+}
+
+void TaskSleepUs(uint32_t sleep_time) {
+    syscall(SYSCALL_TASK_SLEEP_US, current_task, sleep_time, 0);
+}
+
+uint8_t GetCurrentTaskPid(void) {
+    return current_task;
+}
+
+task_handle_t GetCurrentTaskHandle(void) {
+    return TASK_HANDLE(current_task, task_control_blocks[current_task].generation);
+}
+
+uint8_t IsOsStarted(void) {
+    return is_os_started;
+}
+
+#if USE_TASK_ARENA
+// Take size bytes from the arena of the current task, aligned to 8 bytes, NULL if it is used up.
+//   There is no header and no free, the arena is only released by ArenaReset or TaskKill.
+//   Only the task itself allocates from its arena, so there is nothing to lock, and ISRs must not call it.
+void *ArenaAlloc(uint32_t size) {
+    task_control_block_t *this_task = task_control_blocks + current_task;
+    mem_block_header_t *arena = this_task->arena;
+    
+    // Checked before aligning, which would wrap the largest sizes around to 0.
+    if (arena == NULL || size > arena->size) {
+        return NULL;
+    }
+    size = Align(size);
+    if (size > arena->size - this_task->arena_used) {
+        return NULL;
+    }
+    void *ptr = (char *) arena + HEADER_SIZE + this_task->arena_used;
+    this_task->arena_used += size;
+    return ptr;
+}
+
+// Release all that was allocated from the arena of the current task.
+void ArenaReset(void) {
+    task_control_blocks[current_task].arena_used = 0;
+}
+
+// Bytes left in the arena of the current task.
+uint32_t ArenaGetFree(void) {
+    task_control_block_t *this_task = task_control_blocks + current_task;
+    if (this_task->arena == NULL) {
+        return 0;
+    }
+    return this_task->arena->size - this_task->arena_used;
+}
+#endif
+
+// Wake a task blocked in TaskNotifyWait, or let its next wait return at once.
+//   this does not go through syscall, so that it could be called from ISRs.
+void TaskNotify(uint8_t task_pid) {
+    EnterCritical();
+    task_control_block_t *this_task = task_control_blocks + task_pid;
+    
+    if (this_task->status == TASK_STATE_WAIT_NOTIFY) {
+        this_task->status = TASK_STATE_READY;
+        this_task->wake_time = NO_TIMEOUT;
+#if USE_LATENCY_STATS
+        if (GetExceptionNumber()) {
+            this_task->ready_cycles = GetCycleCount();
+        }
+#endif
+    } else if (this_task->status != TASK_STATE_KILLED) {
+        this_task->notified = 1;
+    }
+    
+    LeaveCritical();
+    Yield();
+}
+
+// TaskNotify through a handle, which fails instead of notifying
+//   the next task given the pid once the task of the handle is killed.
+int TaskNotifyHandle(task_handle_t handle) {
+    EnterCritical();
+    if (GetTask(handle) == NULL) {
+        LeaveCritical();
+        return TASK_INVALID_HANDLE;
+    }
+    TaskNotify(TASK_HANDLE_PID(handle));
+    LeaveCritical();
+    return TASK_OK;
+}
+
+int TaskNotifyWait(uint32_t timeout) {
+    return syscall(SYSCALL_TASK_NOTIFY_WAIT, current_task, MsToTicks(timeout), 0);
+}
+
+// Wake a task blocked in _TaskObjectWait, or let its next one return at once.
+//   for the kernel objects, it could be called from ISRs as TaskNotify.
+void _TaskObjectWake(uint8_t task_pid) {
+    EnterCritical();
+    task_control_block_t *this_task = task_control_blocks + task_pid;
+    
+    if (this_task->status == TASK_STATE_WAIT_OBJECT) {
+        this_task->status = TASK_STATE_READY;
+        this_task->wake_time = NO_TIMEOUT;
+#if USE_LATENCY_STATS
+        if (GetExceptionNumber()) {
+            this_task->ready_cycles = GetCycleCount();
+        }
+#endif
+    } else if (this_task->status != TASK_STATE_KILLED) {
+        this_task->object_woken = 1;
+    }
+    
+    LeaveCritical();
+    Yield();
+}
+
+// Wait up to timeout ms for _TaskObjectWake. It could also return early on a
+//   wake up left over from an earlier wait, the caller has to check its object again.
+int _TaskObjectWait(uint32_t timeout) {
+    return syscall(SYSCALL_TASK_OBJECT_WAIT, current_task, MsToTicks(timeout), 0);
+}
+
+uint32_t GetTickCount(void) {
+    return systicks;
+}
+
+#if USE_STACK_PAINTING
+// Fewest free bytes the stack of the task has had so far, as far as the idle task has scanned.
+//   Compare with the stack size given to TaskCreate to see how much of it could be cut.
+uint32_t TaskGetStackHighWater(uint8_t task_pid) {
+    return task_control_blocks[task_pid].stack_free_words * sizeof(uint32_t);
+}
+#endif
+
+uint32_t GetWakePassesSaved(void) {
+    return wake_passes_saved;
+}
+
+#if USE_RUNTIME_STATS
+// Cycles the task has run for, the running task is charged up to now.
+uint64_t TaskGetRunCycles(uint8_t task_pid) {
+    EnterCritical();
+    task_control_block_t *this_task = task_control_blocks + task_pid;
+    if (task_pid == current_task) {
+        AccountRunTime(this_task);
+    }
+    uint64_t run_cycles = this_task->run_cycles;
+    LeaveCritical();
+    return run_cycles;
+}
+
+// Share of the task in the last window, in 0.01%.
+uint16_t TaskGetCpuUsage(uint8_t task_pid) {
+    return task_control_blocks[task_pid].window_usage;
+}
+
+uint16_t GetIdleCpuUsage(void) {
+    return task_control_blocks[idle_task_pid].window_usage;
+}
+
+#if USE_ISR_TIME_STATS
+uint64_t GetIsrCycles(void) {
+    EnterCritical();
+    uint64_t cycles = isr_cycles;
+    LeaveCritical();
+    return cycles;
+}
+
+uint16_t GetIsrCpuUsage(void) {
+    return isr_usage;
+}
+#endif
+#endif
+
+// Bracket an ISR with these to have its time taken off the interrupted task.
+void IsrEnter(void) {
+    TRACE(TRACE_ISR_ENTER, current_task, GetExceptionNumber());
+#if USE_RUNTIME_STATS && USE_ISR_TIME_STATS
+    EnterCritical();
+    if (isr_depth++ == 0) {
+        isr_start_cycles = GetCycleCount();
+    }
+    LeaveCritical();
+#endif
+}
+
+void IsrExit(void) {
+#if USE_RUNTIME_STATS && USE_ISR_TIME_STATS
+    EnterCritical();
+    if (--isr_depth == 0) {
+        uint32_t elapsed = GetCycleCount() - isr_start_cycles;
+        isr_cycles += elapsed;
+        isr_cycles_in_slice += elapsed;
+    }
+    LeaveCritical();
+#endif
+    TRACE(TRACE_ISR_EXIT, current_task, GetExceptionNumber());
+}
+
+uint64_t GetTickCount64(void) {
+    uint32_t high, low;
+    // Read again if systicks wrapped around in between.
+    do {
+        high = systicks_high;
+        low = systicks;
+    } while (high != systicks_high);
+    return ((uint64_t) high << 32) | low;
 }
 
 
 int QueueSendToBlock(uint8_t qcb_id, int32_t item, uint32_t timeout) {
-    return syscall(SYSCALL_SEND_TO_QUEUE, qcb_id, item, timeout);
+    return syscall(SYSCALL_SEND_TO_QUEUE, qcb_id, item, MsToTicks(timeout));
 }
 
 int QueueReceiveFromBlock(uint8_t qcb_id, uint32_t *item_ptr, uint32_t timeout) {
-    return syscall(SYSCALL_RECEIVE_FROM_QUEUE, qcb_id, item_ptr, timeout);
+    return syscall(SYSCALL_RECEIVE_FROM_QUEUE, qcb_id, (uintptr_t) item_ptr, MsToTicks(timeout));
 }
 
 
-// The System Tick Time (SysTick) generates interrupt requests on a regular basis.
-// This allows an OS to carry out context switching to support multiple tasking.
-void SysTick_Handler(void) {
-    if (!is_os_started) return;
-    systicks++;
-    
+static inline void WakeTask(task_control_block_t *this_task) {
+    if (this_task->status == TASK_STATE_WAIT_TO_SENT_QUEUE
+        || this_task->status == TASK_STATE_WAIT_TO_RECEIVE_QUEUE) {
+        queue_waiting_count--;
+        this_task->queue_id = (uint8_t) -2;
+    }
+    this_task->status = TASK_STATE_READY;
+    this_task->wake_time = NO_TIMEOUT;
+#if USE_LATENCY_STATS
+    // Called by SysTick_Handler only.
+    this_task->ready_cycles = GetCycleCount();
+#endif
+}
+
+// Wake up the tasks which are due or whose queue is available,
+//   and find out the next tick that has to be scanned at.
+static void WakeBlockedTasks(void) {
     task_control_block_t *this_task;
-    for (int i = 0; i < task_count; i++) {
+    uint32_t woken_ticks[MAX_TASKS_COUNT]; // distinct ticks the woken tasks were due at
+    uint8_t woken_ticks_count = 0;
+    next_wake_tick = systicks + 0x7fffffff;
+    
+    for (uint32_t live = live_tasks; live; live &= live - 1) {
         
-        this_task = task_control_blocks + i;
+        this_task = task_control_blocks + __builtin_ctz(live);
         
-        // Deal with killed tasks
-        if (this_task->status == TASK_STATE_KILLED) {
+        // Deal with tasks not blocked
+        if (this_task->status == TASK_STATE_READY
+            || this_task->status == TASK_STATE_RUNNING) {
             continue;
         }
         
         // Deal with sleeping tasks
-        if (this_task->sleep_time > 0 && this_task->sleep_time != NO_TIMEOUT) {
-            this_task->sleep_time -= SYSTICK_INTERVAL_MS;
-        }
-        if (this_task->sleep_time <= 0) {
-            this_task->status = TASK_STATE_READY;
-            this_task->sleep_time = 0;
-            continue;
+        if (this_task->wake_time != NO_TIMEOUT) {
+            if (TimeReached(systicks, this_task->wake_time)) {
+                int j = 0;
+                while (j < woken_ticks_count && woken_ticks[j] != this_task->wake_time) {
+                    j++;
+                }
+                if (j == woken_ticks_count) {
+                    woken_ticks[woken_ticks_count++] = this_task->wake_time;
+                }
+                WakeTask(this_task);
+                continue;
+            }
+            if (!TimeReached(this_task->wake_time + this_task->wake_slack, next_wake_tick)) {
+                next_wake_tick = this_task->wake_time + this_task->wake_slack;
+            }
         }
         
         // Deal with tasks blocked by queue
         switch (this_task->status) {
             case TASK_STATE_WAIT_TO_SENT_QUEUE:
                 if (GetEmptyQueueBlock(this_task->queue_id) != NULL) {
-                    this_task->status = TASK_STATE_READY;
-                    this_task->sleep_time = 0;
-                    this_task->queue_id = (uint8_t) -2;
+                    WakeTask(this_task);
                 }
                 break;
             case TASK_STATE_WAIT_TO_RECEIVE_QUEUE:
                 if (GetFilledQueueBlock(this_task->queue_id) != NULL) {
-                    this_task->status = TASK_STATE_READY;
-                    this_task->sleep_time = 0;
-                    this_task->queue_id = (uint8_t) -2;
+                    WakeTask(this_task);
                 }
                 break;
         }
         
     }
     
+    // Without slack, each of the distinct ticks would have needed a scan of its own.
+    if (woken_ticks_count > 1) {
+        wake_passes_saved += woken_ticks_count - 1;
+    }
+}
+
+// The System Tick Time (SysTick) generates interrupt requests on a regular basis.
+// This allows an OS to carry out context switching to support multiple tasking.
+//   called on every tick by the port (SysTick_Handler).
+void _ktTickHandler(void) {
+    if (!is_os_started) return;
+    IsrEnter();
+    if (++systicks == 0) {
+        systicks_high++;
+    }
+    TRACE(TRACE_TICK, current_task, systicks);
+    
+#if USE_RUNTIME_STATS
+    if (TimeReached(systicks, window_end_tick)) {
+        UpdateCpuUsage();
+        window_end_tick = systicks + MS_TO_TICKS(RUNTIME_STATS_WINDOW_MS);
+    }
+#endif
+    
+    // The blocked tasks are only scanned when one of them is due,
+    // or when some of them are waiting for a queue.
+    if (TimeReached(systicks, next_wake_tick) || queue_waiting_count) {
+        WakeBlockedTasks();
+    }
+    
+    // Only the first timer in the list has to be checked.
+    if (_TimerHasExpired(systicks)) {
+        TaskNotify(timer_daemon_pid);
+    }
+    
+    IsrExit();
     Yield();
 }
 
 
 // Critical region methods
-//   Setting PRIMASK to 1 raises the execution priority to 0.
+//   On the Cortex-M3 the port sets PRIMASK to 1, which raises the execution priority to 0.
 //   This prevents any exceptions with configurable priority from
 //   becoming active, except through the fault escalation mechanism
 static uint8_t critical_depth = 0;
+#if USE_LATENCY_STATS || USE_CRITICAL_PROFILER
+static uint32_t critical_start_cycles = 0;
+#endif
+#if USE_CRITICAL_PROFILER
+static uint32_t critical_site = 0;
+#endif
 
+#if USE_CRITICAL_PROFILER
+__attribute__((noinline)) // the return address is the call site.
+#endif
 void EnterCritical(void) {
     if (critical_depth++ == 0) {
-        __set_PRIMASK(1);
+        PortDisableInterrupts();
+#if USE_CRITICAL_PROFILER
+        critical_site = (uint32_t) (uintptr_t) __builtin_return_address(0);
+#endif
+#if USE_LATENCY_STATS || USE_CRITICAL_PROFILER
+        critical_start_cycles = GetCycleCount();
+#endif
     }
 }
 
 void LeaveCritical(void) {
     if (--critical_depth == 0) {
-        __set_PRIMASK(0);
+#if USE_LATENCY_STATS || USE_CRITICAL_PROFILER
+        uint32_t cycles = GetCycleCount() - critical_start_cycles;
+#endif
+#if USE_LATENCY_STATS
+        HistogramAdd(HISTOGRAM_CRITICAL, cycles);
+#endif
+#if USE_CRITICAL_PROFILER
+        CriticalProfilerAdd(critical_site, cycles);
+#endif
+        PortEnableInterrupts();
     }
 }
 
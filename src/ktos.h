@@ -9,7 +9,24 @@
 
 #include "types.h"
 #include "helper.h"
-#include "../CMSIS/CM3/DeviceSupport/ST/STM32F10x/stm32f10x.h"
+#include "timer.h"
+#include "pool.h"
+#include "slab.h"
+#include "malloc.h"
+#include "clock.h"
+#include "trace.h"
+#include "log.h"
+#include "latency.h"
+#include "profiler.h"
+
+// Declare a stack of size bytes for TaskCreateStatic, with the room the port adds to each stack.
+#define TASK_STACK_DEFINE(name, size) \
+    uint32_t name[PORT_STACK_SIZE(size) / sizeof(uint32_t)] __attribute__((aligned(8)))
+
+// Task handles, see task_handle_t.
+#define TASK_HANDLE(pid, generation) ((task_handle_t) (((generation) << 8) | (pid)))
+#define TASK_HANDLE_PID(handle) ((uint8_t) ((handle) & 0xff))
+#define TASK_NO_HANDLE ((task_handle_t) 0xffff)
 
 int ktOSStart(void);
 
@@ -17,12 +34,88 @@ void InitTaskControlBlock(void);
 
 int TaskCreate(TaskFunction entry, void *arg, uint32_t stack_size, uint8_t priority, const char *name);
 
+int TaskCreateWithArena(TaskFunction entry, void *arg, uint32_t stack_size, uint32_t arena_size, uint8_t priority,
+                        const char *name, task_handle_t *handle);
+
+int TaskCreateStatic(TaskFunction entry, void *arg, uint32_t *stack, uint32_t stack_size, uint8_t priority,
+                     const char *name, task_handle_t *handle);
+
 void TaskKill(void);
 
+int TaskDelete(task_handle_t handle);
+
+uint8_t TaskIsAlive(task_handle_t handle);
+
 void TaskSleep(uint32_t sleep_time);
 
+int TaskSleepUntil(uint32_t *last_wake_tick, uint32_t period);
+
+void TaskSleepUs(uint32_t sleep_time);
+
+void TaskSleepWithSlack(uint32_t sleep_time, uint32_t slack);
+
+void TaskSetSlack(uint32_t slack);
+
+uint8_t GetCurrentTaskPid(void);
+
+task_handle_t GetCurrentTaskHandle(void);
+
+uint8_t IsOsStarted(void);
+
+#if USE_TASK_ARENA
+void *ArenaAlloc(uint32_t size);
+
+void ArenaReset(void);
+
+uint32_t ArenaGetFree(void);
+#endif
+
+void TaskNotify(uint8_t task_pid);
+
+int TaskNotifyHandle(task_handle_t handle);
+
+int TaskNotifyWait(uint32_t timeout);
+
+void _TaskObjectWake(uint8_t task_pid);
+
+int _TaskObjectWait(uint32_t timeout);
+
+uint32_t GetTickCount(void);
+
+#if USE_STACK_CHECK
+void StackOverflowHook(uint8_t task_pid, const char *name);
+#endif
+
+#if USE_STACK_PAINTING
+uint32_t TaskGetStackHighWater(uint8_t task_pid);
+#endif
+
+uint64_t GetTickCount64(void);
+
+uint32_t GetWakePassesSaved(void);
+
+#if USE_RUNTIME_STATS
+uint64_t TaskGetRunCycles(uint8_t task_pid);
+
+uint16_t TaskGetCpuUsage(uint8_t task_pid);
+
+uint16_t GetIdleCpuUsage(void);
+
+#if USE_ISR_TIME_STATS
+uint64_t GetIsrCycles(void);
+
+uint16_t GetIsrCpuUsage(void);
+#endif
+#endif
+
+void IsrEnter(void);
+
+void IsrExit(void);
+
 void InitQueueControlBlock(void);
 
+void QueueGetSlabStats(slab_stats_t *stats);
+
 int QueueSendToBlock(uint8_t qcb_id, int32_t item, uint32_t timeout);
 
 int QueueReceiveFromBlock(uint8_t qcb_id, uint32_t *item_ptr, uint32_t timeout);
@@ -0,0 +1,112 @@
+//
+// latency.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#include "latency.h"
+#include "ktos.h"
+
+#if USE_LATENCY_STATS
+
+static histogram_t histograms[HISTOGRAM_COUNT];
+
+// Called by PendSV_Handler and by LeaveCritical with interrupts masked,
+//   each histogram is only updated from one of them, so it takes no lock.
+void HistogramAdd(uint8_t histogram_id, uint32_t cycles) {
+    histogram_t *this_histogram = histograms + histogram_id;
+    uint32_t bucket = cycles ? 31 - __builtin_clz(cycles) : 0;
+    
+    if (bucket >= HISTOGRAM_BUCKETS) {
+        bucket = HISTOGRAM_BUCKETS - 1;
+    }
+    this_histogram->buckets[bucket]++;
+    this_histogram->count++;
+    if (cycles > this_histogram->max) {
+        this_histogram->max = cycles;
+    }
+}
+
+void GetLatencyHistogram(uint8_t histogram_id, histogram_t *histogram) {
+    EnterCritical();
+    memcpy(histogram, histograms + histogram_id, sizeof(histogram_t));
+    LeaveCritical();
+}
+
+void ResetLatencyHistograms(void) {
+    EnterCritical();
+    memset(histograms, 0, sizeof(histograms));
+    LeaveCritical();
+}
+
+#endif
+
+
+#if USE_CRITICAL_PROFILER
+
+// The call sites with the longest regions seen, in no particular order.
+static critical_site_t critical_sites[CRITICAL_PROFILER_SITES];
+static uint8_t critical_site_count = 0;
+
+// Called by LeaveCritical with interrupts masked.
+void CriticalProfilerAdd(uint32_t site, uint32_t cycles) {
+    critical_site_t *this_site;
+    critical_site_t *least_site = critical_sites;
+    
+    for (int i = 0; i < critical_site_count; i++) {
+        this_site = critical_sites + i;
+        if (this_site->site == site) {
+            this_site->count++;
+            if (cycles > this_site->max_cycles) {
+                this_site->max_cycles = cycles;
+            }
+            return;
+        }
+        if (this_site->max_cycles < least_site->max_cycles) {
+            least_site = this_site;
+        }
+    }
+    
+    // A new site, replace the least one if the table is full.
+    if (critical_site_count < CRITICAL_PROFILER_SITES) {
+        this_site = critical_sites + critical_site_count++;
+    } else if (cycles > least_site->max_cycles) {
+        this_site = least_site;
+    } else {
+        return;
+    }
+    this_site->site = site;
+    this_site->max_cycles = cycles;
+    this_site->count = 1;
+}
+
+// Copy the worst sites out, the worst first. The addresses point right after
+// the call to EnterCritical, look them up with arm-none-eabi-addr2line -f -e ktos.elf.
+uint8_t GetCriticalProfile(critical_site_t *sites, uint8_t max_count) {
+    critical_site_t this_site;
+    uint8_t count;
+    int j;
+    
+    EnterCritical();
+    count = critical_site_count < max_count ? critical_site_count : max_count;
+    memcpy(sites, critical_sites, count * sizeof(critical_site_t));
+    LeaveCritical();
+    
+    // Insertion sort, the table is tiny.
+    for (int i = 1; i < count; i++) {
+        this_site = sites[i];
+        for (j = i; j > 0 && sites[j - 1].max_cycles < this_site.max_cycles; j--) {
+            sites[j] = sites[j - 1];
+        }
+        sites[j] = this_site;
+    }
+    return count;
+}
+
+void ResetCriticalProfile(void) {
+    EnterCritical();
+    critical_site_count = 0;
+    LeaveCritical();
+}
+
+#endif
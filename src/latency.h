@@ -0,0 +1,33 @@
+//
+// latency.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_LATENCY_H
+#define KTOS_LATENCY_H
+
+#include "types.h"
+#include "config.h"
+
+#if USE_LATENCY_STATS
+
+void HistogramAdd(uint8_t histogram_id, uint32_t cycles);
+
+void GetLatencyHistogram(uint8_t histogram_id, histogram_t *histogram);
+
+void ResetLatencyHistograms(void);
+
+#endif
+
+#if USE_CRITICAL_PROFILER
+
+void CriticalProfilerAdd(uint32_t site, uint32_t cycles);
+
+uint8_t GetCriticalProfile(critical_site_t *sites, uint8_t max_count);
+
+void ResetCriticalProfile(void);
+
+#endif
+
+#endif //KTOS_LATENCY_H
@@ -0,0 +1,164 @@
+//
+// log.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#include "log.h"
+#include "ktos.h"
+#if LOG_SINK == LOG_SINK_STDOUT
+#include <stdio.h>
+#endif
+
+#if USE_LOG
+
+// One buffer per task control block, and one more shared by the ISRs.
+static log_buffer_t log_buffers[MAX_TASKS_COUNT + 1];
+#define ISR_LOG_BUFFER (log_buffers + MAX_TASKS_COUNT)
+
+// Only the owner of the buffer moves head, so no lock is needed.
+static void PushToBuffer(log_buffer_t *this_buffer, const char *string, uint32_t length) {
+    uint16_t head = this_buffer->head;
+    uint16_t space = (uint16_t) (LOG_BUFFER_SIZE - 1 - ((head - this_buffer->tail) & (LOG_BUFFER_SIZE - 1)));
+    
+    // Drop the whole message rather than a part of it.
+    if (length > space) {
+        this_buffer->dropped += length;
+        return;
+    }
+    
+    while (length--) {
+        this_buffer->data[head] = *string++;
+        head = (head + 1) & (LOG_BUFFER_SIZE - 1);
+    }
+    this_buffer->head = head;
+}
+
+void LogWrite(const char *string, uint32_t length) {
+    if (GetExceptionNumber()) {
+        // ISRs could preempt each other, so their buffer is locked.
+        EnterCritical();
+        PushToBuffer(ISR_LOG_BUFFER, string, length);
+        LeaveCritical();
+    } else {
+        PushToBuffer(log_buffers + GetCurrentTaskPid(), string, length);
+    }
+}
+
+void LogPrintf(const char *format, ...) {
+    char line[LOG_LINE_SIZE];
+    va_list args;
+    
+    va_start(args, format);
+    uint32_t length = FormatString(line, LOG_LINE_SIZE, format, args);
+    va_end(args);
+    
+    if (length > LOG_LINE_SIZE - 1) {
+        length = LOG_LINE_SIZE - 1;
+    }
+    LogWrite(line, length);
+}
+
+uint32_t GetLogDropped(void) {
+    uint32_t dropped = 0;
+    for (int i = 0; i < MAX_TASKS_COUNT + 1; i++) {
+        dropped += log_buffers[i].dropped;
+    }
+    return dropped;
+}
+
+
+#if LOG_SINK == LOG_SINK_UART
+static void InitSink(void) {
+    RCC->APB2ENR |= RCC_APB2ENR_IOPAEN | RCC_APB2ENR_USART1EN;
+    // PA9 as alternate function push-pull, 50MHz.
+    GPIOA->CRH = (GPIOA->CRH & ~(GPIO_CRH_MODE9 | GPIO_CRH_CNF9)) | GPIO_CRH_MODE9 | GPIO_CRH_CNF9_1;
+    USART1->BRR = SystemCoreClock / LOG_UART_BAUD;
+    USART1->CR1 = USART_CR1_UE | USART_CR1_TE;
+}
+
+static inline void PutToSink(char c) {
+    while (!(USART1->SR & USART_SR_TXE));
+    USART1->DR = (uint8_t) c;
+}
+#elif LOG_SINK == LOG_SINK_STDOUT
+static void InitSink(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+}
+
+static inline void PutToSink(char c) {
+    putchar(c);
+}
+#else
+static void InitSink(void) {
+    // The ITM itself is set up by the debugger, which books port 0 for SWO.
+}
+
+// Discarded if no debugger has enabled ITM port 0.
+static inline void PutToSink(char c) {
+    ITM_SendChar((uint8_t) c);
+}
+#endif
+
+// Copy the buffers out to the sink, it runs at a priority just above the idle task
+// so that the time spent on the slow sink is not taken from the others.
+void _LogTask(void) {
+    log_buffer_t *this_buffer;
+    uint16_t tail;
+    
+    InitSink();
+    while (1) {
+        for (int i = 0; i < MAX_TASKS_COUNT + 1; i++) {
+            this_buffer = log_buffers + i;
+            tail = this_buffer->tail;
+            while (tail != this_buffer->head) {
+                PutToSink(this_buffer->data[tail]);
+                tail = (tail + 1) & (LOG_BUFFER_SIZE - 1);
+            }
+            this_buffer->tail = tail;
+        }
+        TaskSleep(LOG_DRAIN_INTERVAL_MS);
+    }
+}
+
+#endif
+
+
+#if USE_BINLOG
+
+binlog_t ktos_binlog;
+
+void InitBinLog(void) {
+    ktos_binlog.magic = BINLOG_MAGIC;
+    ktos_binlog.size = BINLOG_BUFFER_WORDS;
+    ktos_binlog.core_clock = SystemCoreClock;
+    ktos_binlog.head = 0;
+}
+
+// A record is a header word (marker, argument count, format id),
+// the DWT cycles, then the arguments.
+void _LogBinary(uint32_t format_id, uint32_t arg_count, ...) {
+    va_list args;
+    uint32_t primask;
+    
+    if (arg_count > BINLOG_MAX_ARGS) {
+        arg_count = BINLOG_MAX_ARGS;
+    }
+    
+    va_start(args, arg_count);
+    primask = PortMaskInterrupts();
+    
+    uint32_t head = ktos_binlog.head;
+    ktos_binlog.words[head++ & (BINLOG_BUFFER_WORDS - 1)] =
+            ((uint32_t) BINLOG_MARKER << 24) | (arg_count << 16) | (format_id & 0xffff);
+    ktos_binlog.words[head++ & (BINLOG_BUFFER_WORDS - 1)] = GetCycleCount();
+    while (arg_count--) {
+        ktos_binlog.words[head++ & (BINLOG_BUFFER_WORDS - 1)] = va_arg(args, uint32_t);
+    }
+    ktos_binlog.head = head;
+    
+    PortRestoreInterrupts(primask);
+    va_end(args);
+}
+
+#endif
@@ -0,0 +1,64 @@
+//
+// log.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_LOG_H
+#define KTOS_LOG_H
+
+#include "types.h"
+#include "config.h"
+
+#if USE_LOG
+
+void LogWrite(const char *string, uint32_t length);
+
+void LogPrintf(const char *format, ...);
+
+uint32_t GetLogDropped(void);
+
+void _LogTask(void);
+
+#endif
+
+#if USE_BINLOG
+
+#define BINLOG_MAGIC 0x6b74424c
+#define BINLOG_MARKER 0xa5
+#define BINLOG_MAX_ARGS 6
+
+// The whole struct is dumped by the debugger and decoded by tools/binlog.py.
+typedef struct _binlog_t {
+    uint32_t magic;
+    uint32_t size;          // BINLOG_BUFFER_WORDS
+    uint32_t core_clock;    // cycles per second
+    volatile uint32_t head; // words written so far, the oldest ones get overwritten
+    uint32_t words[BINLOG_BUFFER_WORDS];
+} binlog_t;
+
+extern binlog_t ktos_binlog;
+
+void InitBinLog(void);
+
+void _LogBinary(uint32_t format_id, uint32_t arg_count, ...);
+
+#define _LOGB_COUNT(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define _LOGB_ARG_COUNT(...) _LOGB_COUNT(_0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+// Log without formatting, only the id of the format string and the raw arguments
+// (up to 6, each as 32 bits) are recorded. The format string is put into a section
+// that is not loaded, its offset in the section is the id.
+//   %s is only supported for strings in flash, which are read back from the ELF.
+#define LOGB(format, ...) do { \
+        static const char _logb_format[] __attribute__((section(".ktos_log_strings"), used)) = format; \
+        _LogBinary((uint32_t) (uintptr_t) _logb_format, _LOGB_ARG_COUNT(__VA_ARGS__), ##__VA_ARGS__); \
+    } while (0)
+
+#else
+
+#define LOGB(format, ...)
+
+#endif
+
+#endif //KTOS_LOG_H
@@ -4,20 +4,10 @@
 // Created by Kotorinyanya.
 //
 #include "ktos.h"
-#include "../CMSIS/CM3/CoreSupport/core_cm3.h"
 #include "config.h"
-#include <stdio.h>
 
-void Init(void)
-{
-    NVIC_SetPriorityGrouping(0);
-
-    SysTick_Config(SystemCoreClock / SYSTICK_FREQUENCY_HZ);
-
-    NVIC_SetPriority(SysTick_IRQn, NVIC_EncodePriority(0, 0, 0));
-    NVIC_SetPriority(SVCall_IRQn, NVIC_EncodePriority(0, 1, 0));
-    NVIC_SetPriority(PendSV_IRQn, NVIC_EncodePriority(0, 1, 0));
-}
+// bar runs on a stack placed by the linker rather than taken from the heap.
+static TASK_STACK_DEFINE(bar_stack, 2048);
 
 void foo(void)
 {
@@ -25,16 +15,16 @@ void foo(void)
     int result;
     int queue_id = 3;
     int timeout = 0;
-    printf("I am foo\n");
+    LogPrintf("I am foo\n");
     for(;;) {
         TaskSleep(100);
         result = QueueSendToBlock(queue_id, count, timeout);
         switch (result) {
             case QUEUE_SENT_OK:
-                printf("Hello bar %d\n", count++);
+                LogPrintf("Hello bar %d\n", count++);
                 break;
             case QUEUE_SENT_FAILED:
-                printf("Sorry bar \n");
+                LogPrintf("Sorry bar \n");
                 break;
         }
         if(count == 5) {
@@ -49,16 +39,18 @@ void bar(void)
     int result;
     int queue_id = 3;
     int timeout = 0;
-    printf("I am bar\n");
+    LogPrintf("I am bar\n");
     for(;;) {
         TaskSleep(150);
         result = QueueReceiveFromBlock(queue_id, &item, timeout);
         switch (result) {
             case QUEUE_RECEIVE_OK:
-                printf("OK foo %d\n", item);
+                LogPrintf("OK foo %d\n", item);
+                // Also recorded raw, to be formatted on the host by tools/binlog.py.
+                LOGB("received %d from queue %d\n", item, queue_id);
                 break;
             case QUEUE_RECEIVE_FAILED:
-                printf("Sorry foo \n");
+                LogPrintf("Sorry foo \n");
                 break;
         }
     }
@@ -68,14 +60,16 @@ int main(void)
 {
     InitQueueControlBlock();
     InitTaskControlBlock();
+    InitTimerControlBlock();
+    InitBlockPoolControlBlock();
     
     TaskCreate((TaskFunction)foo, 0, 2048, 3, "foo");
-    TaskCreate((TaskFunction)bar, 0, 2048, 3, "bar");
+    TaskCreateStatic((TaskFunction)bar, 0, bar_stack, sizeof(bar_stack), 3, "bar", NULL);
 
     ktOSStart();
 
     while(1) {
-        printf("Oops! What happened ???\n");
+        LogPrintf("Oops! What happened ???\n");
     }
 
 }
\ No newline at end of file
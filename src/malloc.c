@@ -0,0 +1,168 @@
+//
+// malloc.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+// The C allocation functions over the kernel heap, so that there is one allocator,
+//   safe against preemption and ISRs, instead of newlib's over _sbrk. Each block
+//   keeps the pid of the task that allocated it, and its bytes are counted to that
+//   task until it is freed, whichever task frees it, or until the task is killed.
+//
+
+#include <stddef.h>
+#include "malloc.h"
+#include "ktos.h"
+
+#if USE_KERNEL_MALLOC
+
+struct _reent;
+
+// Payload bytes allocated by each task, and by ISRs or before the kernel was started.
+static uint32_t task_heap_bytes[MAX_TASKS_COUNT];
+static uint32_t unowned_heap_bytes = 0;
+
+
+static inline void *GetPayload(mem_block_header_t *this_block) {
+    return (char *) this_block + HEADER_SIZE;
+}
+
+static inline mem_block_header_t *GetBlock(void *ptr) {
+    return (mem_block_header_t *) ((char *) ptr - HEADER_SIZE);
+}
+
+// Both of the accounting methods must be called inside a critical region.
+static void Account(mem_block_header_t *this_block) {
+    if (IsOsStarted() && !GetExceptionNumber()) {
+        task_handle_t handle = GetCurrentTaskHandle();
+        this_block->owner = TASK_HANDLE_PID(handle);
+        this_block->owner_generation = (uint8_t) (handle >> 8);
+    }
+    if (this_block->owner < MAX_TASKS_COUNT) {
+        task_heap_bytes[this_block->owner] += this_block->size;
+    } else {
+        unowned_heap_bytes += this_block->size;
+    }
+}
+
+// The bytes of a killed owner have been moved to the unowned ones by _HeapForgetTask.
+static void Unaccount(mem_block_header_t *this_block) {
+    if (this_block->owner < MAX_TASKS_COUNT
+        && TaskIsAlive(TASK_HANDLE(this_block->owner, this_block->owner_generation))) {
+        task_heap_bytes[this_block->owner] -= this_block->size;
+    } else {
+        unowned_heap_bytes -= this_block->size;
+    }
+}
+
+
+// Not malloc itself, so that the compiler does not turn the malloc and memset
+//   of calloc back into a call to calloc.
+static void *Allocate(size_t size) {
+    if (size > MEM_POOL_SIZE) {
+        return NULL;
+    }
+
+    EnterCritical();
+    mem_block_header_t *this_block = AllocateMemBlock((uint32_t) size);
+    if (this_block == NULL) {
+        LeaveCritical();
+        return NULL;
+    }
+    Account(this_block);
+    LeaveCritical();
+    return GetPayload(this_block);
+}
+
+
+void *malloc(size_t size) {
+    return Allocate(size);
+}
+
+void free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    EnterCritical();
+    mem_block_header_t *this_block = GetBlock(ptr);
+    Unaccount(this_block);
+    FreeMemBlock(this_block);
+    LeaveCritical();
+}
+
+void *calloc(size_t count, size_t size) {
+    if (size != 0 && count > MEM_POOL_SIZE / size) {
+        return NULL;
+    }
+
+    void *ptr = Allocate(count * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+// A block large enough already is kept, otherwise the data is moved to a new one,
+//   the copy is done outside of the critical regions.
+void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    uint32_t old_size = GetBlock(ptr)->size;
+    if (size <= old_size) {
+        return ptr;
+    }
+    void *new_ptr = malloc(size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size);
+        free(ptr);
+    }
+    return new_ptr;
+}
+
+// Lock hooks of newlib, for the parts of it that still take the malloc lock.
+//   the kernel critical region nests, as the lock has to.
+void __malloc_lock(struct _reent *reent) {
+    (void) reent;
+    EnterCritical();
+}
+
+void __malloc_unlock(struct _reent *reent) {
+    (void) reent;
+    LeaveCritical();
+}
+
+// Nothing is to be taken from the RAM past .bss, it belongs to the kernel heap.
+void *_sbrk(ptrdiff_t increment) {
+    (void) increment;
+    return (void *) -1;
+}
+
+// Bytes of the blocks allocated by the task and not freed yet.
+uint32_t TaskGetHeapUsage(uint8_t task_pid) {
+    if (task_pid >= MAX_TASKS_COUNT) {
+        return 0;
+    }
+    return task_heap_bytes[task_pid];
+}
+
+// Called by the kernel when the task is killed, its blocks not freed yet are
+//   no longer counted to it, and not to the next task given its pid.
+void _HeapForgetTask(uint8_t task_pid) {
+    EnterCritical();
+    unowned_heap_bytes += task_heap_bytes[task_pid];
+    task_heap_bytes[task_pid] = 0;
+    LeaveCritical();
+}
+
+// Bytes allocated by ISRs, before the kernel was started, or by the tasks killed since.
+uint32_t GetUnownedHeapUsage(void) {
+    return unowned_heap_bytes;
+}
+
+#endif
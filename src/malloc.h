@@ -0,0 +1,23 @@
+//
+// malloc.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_MALLOC_H
+#define KTOS_MALLOC_H
+
+#include "types.h"
+#include "config.h"
+
+#if USE_KERNEL_MALLOC
+
+uint32_t TaskGetHeapUsage(uint8_t task_pid);
+
+uint32_t GetUnownedHeapUsage(void);
+
+void _HeapForgetTask(uint8_t task_pid);
+
+#endif
+
+#endif //KTOS_MALLOC_H
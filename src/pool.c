@@ -0,0 +1,277 @@
+//
+// pool.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+// Pools of fixed-size blocks, over a static buffer or a block carved from the heap.
+//   The free blocks are linked through their first word, so that allocation and
+//   free pop and push the head of the list in constant time. Both only mask the
+//   interrupts for those few instructions, and could be called from ISRs.
+//
+
+#include "pool.h"
+#include "ktos.h"
+
+#define BLOCK_ALIGN_SIZE 8
+
+_Static_assert(MAX_TASKS_COUNT <= 32, "the waiting tasks are kept in a 32-bit bitmap");
+
+// Block pool control block.
+static block_pool_t block_pool_control_blocks[MAX_BLOCK_POOL_COUNT];
+
+
+static block_pool_t *GetBlockPool(uint8_t pool_id) {
+    if (pool_id >= MAX_BLOCK_POOL_COUNT) {
+        return NULL;
+    }
+    block_pool_t *this_pool = block_pool_control_blocks + pool_id;
+    if (this_pool->id == BLOCK_POOL_NOT_BEING_USED) {
+        return NULL;
+    }
+    return this_pool;
+}
+
+// Both of the list methods must be called with the interrupts masked.
+static void *PopBlock(block_pool_t *this_pool) {
+    void *block = this_pool->free_list;
+    if (block == NULL) {
+        return NULL;
+    }
+    this_pool->free_list = *(void **) block;
+    if (--this_pool->free_count < this_pool->min_free_count) {
+        this_pool->min_free_count = this_pool->free_count;
+    }
+    return block;
+}
+
+static void PushBlock(block_pool_t *this_pool, void *block) {
+    *(void **) block = this_pool->free_list;
+    this_pool->free_list = block;
+    this_pool->free_count++;
+}
+
+static uint8_t IsPoolBlock(block_pool_t *this_pool, void *block) {
+    uintptr_t offset = (uintptr_t) block - (uintptr_t) this_pool->start;
+    return (char *) block >= this_pool->start
+           && offset < this_pool->block_count * this_pool->block_size
+           && offset % this_pool->block_size == 0;
+}
+
+// Hand the next waiting task over to the caller, which has to wake it
+//   once the interrupts are unmasked again. The lowest pid goes first.
+static int8_t TakeWaitingTask(block_pool_t *this_pool) {
+    if (!this_pool->waiting) {
+        return -1;
+    }
+    uint8_t task_pid = (uint8_t) __builtin_ctz(this_pool->waiting);
+    this_pool->waiting &= ~(1U << task_pid);
+    return (int8_t) task_pid;
+}
+
+
+void InitBlockPoolControlBlock(void) {
+    block_pool_t *this_pool;
+    for (int i = 0; i < MAX_BLOCK_POOL_COUNT; i++) {
+        this_pool = block_pool_control_blocks + i;
+        this_pool->id = BLOCK_POOL_NOT_BEING_USED;
+        this_pool->free_list = NULL;
+        this_pool->mem_block = NULL;
+        this_pool->waiting = 0;
+    }
+}
+
+// The buffer must be aligned to 8 bytes and hold BLOCK_POOL_BUFFER_SIZE(block_size, block_count) bytes.
+int BlockPoolCreate(void *buffer, uint32_t block_size, uint32_t block_count, uint8_t *pool_id) {
+    if (buffer == NULL || block_size == 0 || block_count == 0
+        || (uintptr_t) buffer % BLOCK_ALIGN_SIZE != 0) {
+        return BLOCK_POOL_INVALID;
+    }
+    // Each block has to hold the link of the free list.
+    block_size = Align(block_size);
+    if (block_size < sizeof(void *)) {
+        block_size = Align(sizeof(void *));
+    }
+
+    EnterCritical();
+    block_pool_t *this_pool;
+    for (int i = 0; i < MAX_BLOCK_POOL_COUNT; i++) {
+        this_pool = block_pool_control_blocks + i;
+        if (this_pool->id == BLOCK_POOL_NOT_BEING_USED) {
+            this_pool->id = (uint8_t) i;
+            this_pool->start = (char *) buffer;
+            this_pool->block_size = block_size;
+            this_pool->block_count = block_count;
+            this_pool->free_count = 0;
+            this_pool->failed_count = 0;
+            this_pool->waiting = 0;
+            this_pool->mem_block = NULL;
+            this_pool->free_list = NULL;
+            // Pushed from the last block down, so that they are handed out in address order.
+            for (uint32_t j = block_count; j > 0; j--) {
+                PushBlock(this_pool, this_pool->start + (j - 1) * block_size);
+            }
+            this_pool->min_free_count = block_count;
+            *pool_id = (uint8_t) i;
+            LeaveCritical();
+            return BLOCK_POOL_OK;
+        }
+    }
+
+    LeaveCritical();
+    return BLOCK_POOL_AMOUNT_MAXIMUM_EXCEEDED;
+}
+
+int BlockPoolCreateFromHeap(uint32_t block_size, uint32_t block_count, uint8_t *pool_id) {
+    if (block_size == 0 || block_count == 0
+        || block_count > MEM_POOL_SIZE / BLOCK_POOL_BUFFER_SIZE(block_size, 1)) {
+        return BLOCK_POOL_INVALID;
+    }
+
+    EnterCritical();
+    mem_block_header_t *mem_block = AllocateMemBlock(BLOCK_POOL_BUFFER_SIZE(block_size, block_count));
+    if (mem_block == NULL) {
+        LeaveCritical();
+        return MEM_POOL_MAXIMUM_EXCEEDED;
+    }
+
+    int result = BlockPoolCreate((char *) mem_block + HEADER_SIZE, block_size, block_count, pool_id);
+    if (result != BLOCK_POOL_OK) {
+        FreeMemBlock(mem_block);
+    } else {
+        block_pool_control_blocks[*pool_id].mem_block = mem_block;
+    }
+    LeaveCritical();
+    return result;
+}
+
+// The blocks of the pool must not be in use any more, the tasks waiting on it return NULL.
+int BlockPoolDelete(uint8_t pool_id) {
+    EnterCritical();
+    block_pool_t *this_pool = GetBlockPool(pool_id);
+    if (this_pool == NULL) {
+        LeaveCritical();
+        return BLOCK_POOL_INVALID;
+    }
+
+    if (this_pool->mem_block != NULL) {
+        FreeMemBlock(this_pool->mem_block);
+        this_pool->mem_block = NULL;
+    }
+    this_pool->id = BLOCK_POOL_NOT_BEING_USED;
+    this_pool->free_list = NULL;
+    uint32_t waiting = this_pool->waiting;
+    this_pool->waiting = 0;
+    LeaveCritical();
+
+    while (waiting) {
+        uint8_t task_pid = (uint8_t) __builtin_ctz(waiting);
+        waiting &= ~(1U << task_pid);
+        _TaskObjectWake(task_pid);
+    }
+    return BLOCK_POOL_OK;
+}
+
+// Take a block, waiting up to timeout ms for one to be freed if the pool is empty.
+//   ISRs must not wait, a timeout given by them is taken as 0.
+void *BlockAlloc(uint8_t pool_id, uint32_t timeout) {
+    uint8_t can_wait = timeout != 0 && !PortGetExceptionNumber();
+    uint8_t task_pid = GetCurrentTaskPid();
+    uint32_t deadline = GetTickCount() + MsToTicks(timeout);
+    uint32_t wait_ms = timeout;
+
+    while (1) {
+        uint32_t masked = PortMaskInterrupts();
+        // The pool could also have been deleted while waiting.
+        block_pool_t *this_pool = GetBlockPool(pool_id);
+        if (this_pool == NULL) {
+            PortRestoreInterrupts(masked);
+            return NULL;
+        }
+
+        void *block = PopBlock(this_pool);
+        if (block != NULL || !can_wait) {
+            if (block == NULL) {
+                this_pool->failed_count++;
+            } else if (can_wait) {
+                this_pool->waiting &= ~(1U << task_pid);
+            }
+            PortRestoreInterrupts(masked);
+            return block;
+        }
+        // Another task could have taken the block this one was woken up for.
+        if (timeout != NO_TIMEOUT) {
+            uint32_t now = GetTickCount();
+            if (TimeReached(now, deadline)) {
+                this_pool->waiting &= ~(1U << task_pid);
+                this_pool->failed_count++;
+                PortRestoreInterrupts(masked);
+                return NULL;
+            }
+            wait_ms = (deadline - now + TICKS_PER_MS - 1) / TICKS_PER_MS;
+        }
+        // Marked with the interrupts still masked, so that a free in between is not missed.
+        this_pool->waiting |= 1U << task_pid;
+        PortRestoreInterrupts(masked);
+
+        _TaskObjectWait(wait_ms);
+    }
+}
+
+// Give the block back, and wake up a task waiting for one.
+int BlockFree(uint8_t pool_id, void *block) {
+    uint32_t masked = PortMaskInterrupts();
+    block_pool_t *this_pool = GetBlockPool(pool_id);
+    if (this_pool == NULL || !IsPoolBlock(this_pool, block)) {
+        PortRestoreInterrupts(masked);
+        return BLOCK_POOL_INVALID;
+    }
+
+    PushBlock(this_pool, block);
+    int8_t task_pid = TakeWaitingTask(this_pool);
+    PortRestoreInterrupts(masked);
+
+    if (task_pid >= 0) {
+        _TaskObjectWake((uint8_t) task_pid);
+    }
+    return BLOCK_POOL_OK;
+}
+
+// Called by the kernel when the task is killed, so that the blocks freed later are
+//   not handed to it, nor to the next task given its pid. It could also have been
+//   woken for a block it will not take now, which is passed on to the next waiting task.
+//   must be called inside a critical region.
+void _BlockPoolForgetTask(uint8_t task_pid) {
+    uint32_t masked = PortMaskInterrupts();
+    block_pool_t *this_pool;
+    for (int i = 0; i < MAX_BLOCK_POOL_COUNT; i++) {
+        this_pool = block_pool_control_blocks + i;
+        if (this_pool->id == BLOCK_POOL_NOT_BEING_USED) {
+            continue;
+        }
+        this_pool->waiting &= ~(1U << task_pid);
+        if (this_pool->free_list != NULL) {
+            int8_t next_pid = TakeWaitingTask(this_pool);
+            if (next_pid >= 0) {
+                _TaskObjectWake((uint8_t) next_pid);
+            }
+        }
+    }
+    PortRestoreInterrupts(masked);
+}
+
+int BlockPoolGetStats(uint8_t pool_id, block_pool_stats_t *stats) {
+    uint32_t masked = PortMaskInterrupts();
+    block_pool_t *this_pool = GetBlockPool(pool_id);
+    if (this_pool == NULL) {
+        PortRestoreInterrupts(masked);
+        return BLOCK_POOL_INVALID;
+    }
+
+    stats->block_size = this_pool->block_size;
+    stats->block_count = this_pool->block_count;
+    stats->used_count = this_pool->block_count - this_pool->free_count;
+    stats->max_used_count = this_pool->block_count - this_pool->min_free_count;
+    stats->failed_count = this_pool->failed_count;
+    PortRestoreInterrupts(masked);
+    return BLOCK_POOL_OK;
+}
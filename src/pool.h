@@ -0,0 +1,32 @@
+//
+// pool.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_POOL_H
+#define KTOS_POOL_H
+
+#include "types.h"
+#include "config.h"
+
+// Bytes of the buffer given to BlockPoolCreate, the blocks are rounded up to 8 bytes.
+#define BLOCK_POOL_BUFFER_SIZE(block_size, block_count) ((((block_size) + 7) & ~7) * (block_count))
+
+void InitBlockPoolControlBlock(void);
+
+int BlockPoolCreate(void *buffer, uint32_t block_size, uint32_t block_count, uint8_t *pool_id);
+
+int BlockPoolCreateFromHeap(uint32_t block_size, uint32_t block_count, uint8_t *pool_id);
+
+int BlockPoolDelete(uint8_t pool_id);
+
+void *BlockAlloc(uint8_t pool_id, uint32_t timeout);
+
+int BlockFree(uint8_t pool_id, void *block);
+
+int BlockPoolGetStats(uint8_t pool_id, block_pool_stats_t *stats);
+
+void _BlockPoolForgetTask(uint8_t task_pid);
+
+#endif //KTOS_POOL_H
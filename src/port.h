@@ -0,0 +1,77 @@
+//
+// port.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+// Boundary between the portable kernel and the machine it runs on.
+//   port/cm3 is the Cortex-M3 (STM32F10x), port/posix simulates it on a host,
+//   selected by PORT_POSIX in config.h. Each port provides the inline
+//   primitives in its portmacro.h and the functions below in its port.c.
+//
+
+#ifndef KTOS_PORT_H
+#define KTOS_PORT_H
+
+#include "config.h"
+
+#if PORT_POSIX
+#include "port/posix/portmacro.h"
+#else
+#include "port/cm3/portmacro.h"
+#endif
+
+// Start the tick at SYSTICK_FREQUENCY_HZ, which calls _ktTickHandler.
+void PortInitTicker(void);
+
+void PortInitCycleCounter(void);
+
+uint32_t PortGetCyclesPerTick(void);
+
+// Cycles elapsed in the current tick, tick_pending is set if the tick has
+//   already ended but _ktTickHandler has not run yet. Called inside a critical region.
+uint32_t PortGetTickCycles(uint8_t *tick_pending);
+
+// Lay out the initial context of a task at the top of its stack, so that it starts
+//   with entry(arg) and calls exit when entry returns. Returns the saved stack top.
+uint32_t *PortInitStack(uint32_t *stack_bottom, uint32_t stack_size,
+                        void (*entry)(void *), void *arg, void (*exit)(void));
+
+// Switch to the first task, and set started just before it runs. It does not return.
+void PortStartFirstTask(uint32_t *stack_top, volatile uint8_t *started);
+
+#if USE_TIM2_ONE_SHOT
+// Start the one-shot timer, which calls _ktOneShotHandler after us microseconds (up to 0xffff).
+void PortOneShotStart(uint32_t us);
+#endif
+
+#if USE_PROFILER
+// Start the profiler timer, which calls _ProfilerSample rate_hz times a second.
+void PortProfilerTimerStart(uint32_t rate_hz);
+
+void PortProfilerTimerStop(void);
+#endif
+
+
+// The kernel side, called by the port.
+
+// Supervisor call dispatcher, called in the syscall handler.
+int32_t _ktSyscall(uint32_t code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
+
+// Save the stack top of the running task and return the one of the next task,
+//   called in the context switch handler.
+uint32_t *_ContextSwitcher(uint32_t *stack_top);
+
+// Called on every tick.
+void _ktTickHandler(void);
+
+#if USE_TIM2_ONE_SHOT
+// Called once the one-shot timer has expired.
+void _ktOneShotHandler(void);
+#endif
+
+#if USE_PROFILER
+// Called by the profiler timer with the interrupted PC, is_task is cleared if an ISR was interrupted.
+void _ProfilerSample(uint32_t pc, uint8_t is_task);
+#endif
+
+#endif //KTOS_PORT_H
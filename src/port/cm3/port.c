@@ -0,0 +1,205 @@
+//
+// port.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#include "../../ktos.h"
+
+void PortInitTicker(void) {
+    SysTick_Config(SystemCoreClock / SYSTICK_FREQUENCY_HZ);
+
+    NVIC_SetPriorityGrouping(0);
+    NVIC_SetPriority(SysTick_IRQn, NVIC_EncodePriority(0, 0, 0));
+    NVIC_SetPriority(SVCall_IRQn, NVIC_EncodePriority(0, 1, 0));
+    NVIC_SetPriority(PendSV_IRQn, NVIC_EncodePriority(0, 2, 0));
+}
+
+void PortInitCycleCounter(void) {
+    // Enable the trace block, then the cycle counter of DWT.
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+uint32_t PortGetCyclesPerTick(void) {
+    return SysTick->LOAD + 1;
+}
+
+// SysTick counts down from LOAD to 0, then reloads and pends its interrupt.
+//   If it has reloaded but SysTick_Handler has not run yet (we are in a critical
+//   region, or in an ISR with higher priority), VAL is read again to get the value
+//   after reload, and the caller has to count the pending tick itself.
+uint32_t PortGetTickCycles(uint8_t *tick_pending) {
+    uint32_t load = SysTick->LOAD;
+    uint32_t val = SysTick->VAL;
+
+    *tick_pending = 0;
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET) {
+        val = SysTick->VAL;
+        *tick_pending = 1;
+    }
+    return load - val;
+}
+
+// The task is started by an exception return, which pops the hardware frame,
+//   and r4 - r11 are popped by PendSV_Handler before that.
+uint32_t *PortInitStack(uint32_t *stack_bottom, uint32_t stack_size,
+                        void (*entry)(void *), void *arg, void (*exit)(void)) {
+    uint32_t *stack_top = (uint32_t *) ((uint32_t) stack_bottom - (16 * sizeof(uint32_t)));
+
+    hardware_stack_frame_t *hardware_stack_frame;
+    hardware_stack_frame = (hardware_stack_frame_t *) ((uint32_t) stack_bottom - (8 * sizeof(uint32_t)));
+    hardware_stack_frame->r0 = (uint32_t) arg;
+    hardware_stack_frame->lr = (uint32_t) exit;
+    hardware_stack_frame->pc = (uint32_t) entry;
+    hardware_stack_frame->psr = 0x21000000; //default PSR value
+
+    return stack_top;
+}
+
+// Load the task, and return to thread mode on PSP, the other tasks will be loaded upon context switch.
+//   Called by the SVC handler.
+void PortStartFirstTask(uint32_t *stack_top, volatile uint8_t *started) {
+    register uint32_t *r0 asm("r0") = stack_top;
+    register volatile uint8_t *r1 asm("r1") = started;
+    register int r2 asm("r2") = 1;
+    __asm__ __volatile__ (
+    R"(
+        ldmia %0!, {r4-r11}
+        msr psp, %0
+        strb %2, [%1]
+        ldr pc, =0xFFFFFFFD
+        )"
+    :
+    : "r" (r0), "r" (r1), "r" (r2)
+    );
+}
+
+
+// Supervisor Calls
+//   called by SVC_Handler, with the frame stacked on entry.
+void _ktSvcHandler(hardware_stack_frame_t *hw_ctx) {
+    uint8_t service_no = *(uint8_t *) (hw_ctx->pc - 2);
+    if (service_no != 0x80) {
+        return;
+    }
+    hw_ctx->r0 = _ktSyscall(hw_ctx->r0, hw_ctx->r1, hw_ctx->r2, hw_ctx->r3);
+}
+
+__attribute__((naked)) void SVC_Handler(void) {
+    __asm__(
+    R"(
+        tst lr, #4
+        ite eq
+        mrseq r0, msp
+        mrsne r0, psp
+
+        push {lr}
+        bl _ktSvcHandler
+        pop {pc}
+        )"
+    );
+}
+
+// PendSV will be called by Yield every SysTick.
+//   this is to do the context switch
+__attribute__((naked)) void PendSV_Handler(void) {
+    __asm__ __volatile__(
+    R"(
+        push {lr}
+        mrs r0, psp
+        stmdb r0!, {r4-r11}
+
+        bl _ContextSwitcher
+
+        ldmia r0!, {r4-r11}
+        msr psp, r0
+        pop {pc}
+        )"
+    );
+}
+
+void SysTick_Handler(void) {
+    _ktTickHandler();
+}
+
+
+#if USE_TIM2_ONE_SHOT
+// TIM2 counts in microseconds in one-pulse mode.
+//   TIM2 is assumed to be clocked at SystemCoreClock (APB1 prescaler 2, timer clock doubled).
+static void InitOneShot(void) {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+    TIM2->CR1 = TIM_CR1_OPM | TIM_CR1_URS; // only the overflow raises the update interrupt.
+    TIM2->PSC = SystemCoreClock / 1000000 - 1;
+    TIM2->DIER = TIM_DIER_UIE;
+
+    NVIC_SetPriority(TIM2_IRQn, NVIC_EncodePriority(0, 0, 0));
+    NVIC_EnableIRQ(TIM2_IRQn);
+}
+
+void PortOneShotStart(uint32_t us) {
+    if (!(RCC->APB1ENR & RCC_APB1ENR_TIM2EN)) {
+        InitOneShot();
+    }
+
+    TIM2->ARR = us;
+    TIM2->CNT = 0;
+    // Load the prescaler, URS keeps this from raising the update interrupt.
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->SR = 0;
+    TIM2->CR1 |= TIM_CR1_CEN;
+}
+
+void TIM2_IRQHandler(void) {
+    TIM2->SR = 0;
+    _ktOneShotHandler();
+}
+#endif
+
+#if USE_PROFILER
+// TIM3 counts in microseconds and interrupts at rate_hz.
+//   TIM3 is assumed to be clocked at SystemCoreClock (APB1 prescaler 2, timer clock doubled).
+void PortProfilerTimerStart(uint32_t rate_hz) {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+    TIM3->CR1 = 0;
+    TIM3->PSC = SystemCoreClock / 1000000 - 1;
+    TIM3->ARR = 1000000 / rate_hz - 1;
+    TIM3->CNT = 0;
+    TIM3->EGR = TIM_EGR_UG;
+    TIM3->SR = 0;
+    TIM3->DIER = TIM_DIER_UIE;
+
+    // Highest priority, so that the kernel handlers could be sampled as well.
+    NVIC_SetPriority(TIM3_IRQn, NVIC_EncodePriority(0, 0, 0));
+    NVIC_ClearPendingIRQ(TIM3_IRQn);
+    NVIC_EnableIRQ(TIM3_IRQn);
+    TIM3->CR1 = TIM_CR1_CEN;
+}
+
+void PortProfilerTimerStop(void) {
+    TIM3->CR1 = 0;
+    NVIC_DisableIRQ(TIM3_IRQn);
+}
+
+// Take the PC stacked by the hardware on entry of TIM3_IRQHandler.
+//   The frame is on PSP if a task was interrupted, on MSP if it was an ISR.
+void _PortProfilerTick(hardware_stack_frame_t *hw_ctx, uint32_t exc_return) {
+    TIM3->SR = 0;
+    _ProfilerSample(hw_ctx->pc, (exc_return & 4) != 0);
+}
+
+__attribute__((naked)) void TIM3_IRQHandler(void) {
+    __asm__(
+    R"(
+        tst lr, #4
+        ite eq
+        mrseq r0, msp
+        mrsne r0, psp
+        mov r1, lr
+
+        b _PortProfilerTick
+        )"
+    );
+}
+#endif
@@ -0,0 +1,92 @@
+//
+// portmacro.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+// Cortex-M3 primitives: PendSV does the context switch, SVC the syscalls,
+//   SysTick the tick, and critical regions mask the interrupts by PRIMASK.
+//
+
+#ifndef KTOS_PORTMACRO_H
+#define KTOS_PORTMACRO_H
+
+#include "../../../CMSIS/CM3/DeviceSupport/ST/STM32F10x/stm32f10x.h"
+
+// The C library is discarded by the linker script, helper.c stands in for it.
+#define PORT_HAS_LIBC 0
+
+// Room the port needs on top of the stack size asked for by the task.
+#define PORT_STACK_SIZE(size) (size)
+
+// Data Watchpoint and Trace unit, which is not defined by this version of CMSIS.
+#define DWT_CTRL    (*(volatile uint32_t *) 0xE0001000)
+#define DWT_CYCCNT  (*(volatile uint32_t *) 0xE0001004)
+#define DWT_CTRL_CYCCNTENA 0x00000001
+
+// Pend PendSV, the switch happens once no other exception is active.
+static inline void PortYield(void) {
+    SCB->ICSR = SCB_ICSR_PENDSVSET;
+}
+
+static inline void PortDisableInterrupts(void) {
+    __set_PRIMASK(1);
+}
+
+static inline void PortEnableInterrupts(void) {
+    __set_PRIMASK(0);
+}
+
+// Mask the interrupts and return the previous PRIMASK, for the paths that could
+//   not afford a call to EnterCritical.
+static inline uint32_t PortMaskInterrupts(void) {
+    uint32_t primask;
+    __asm__ __volatile__ ("mrs %0, primask\n cpsid i" : "=r" (primask) :: "memory");
+    return primask;
+}
+
+static inline void PortRestoreInterrupts(uint32_t primask) {
+    __asm__ __volatile__ ("msr primask, %0" :: "r" (primask) : "memory");
+}
+
+static inline uint32_t PortGetCycleCount(void) {
+    return DWT_CYCCNT;
+}
+
+// Nothing is to be done with a stack before it is laid out by PortInitStack.
+static inline void PortPrepareStack(uint32_t *stack_end, uint32_t stack_size) {
+    (void) stack_end;
+    (void) stack_size;
+}
+
+// Number of the exception being handled, 0 in thread mode.
+static inline uint32_t PortGetExceptionNumber(void) {
+    uint32_t ipsr;
+    __asm__ __volatile__ ("mrs %0, ipsr" : "=r" (ipsr));
+    return ipsr & 0x1ff;
+}
+
+static inline void PortIdle(void) {
+    // "wfe" (A.K.A. wait for event)
+    __asm__ ("wfe");
+}
+
+// The arguments are passed to SVC_Handler in r0 - r3, and the result is returned in r0.
+static inline int32_t PortSyscall(uint32_t code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3) {
+    int32_t result;
+    __asm__ __volatile__ (
+    R"(
+        mov r0, %1
+        mov r1, %2
+        mov r2, %3
+        mov r3, %4
+        svc #0x80
+        mov %0, r0
+        )"
+    : "=r" (result)
+    : "r" (code), "r" (arg1), "r" (arg2), "r" (arg3)
+    : "r0", "r1", "r2", "r3"
+    );
+    return result;
+}
+
+#endif //KTOS_PORTMACRO_H
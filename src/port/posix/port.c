@@ -0,0 +1,207 @@
+//
+// port.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+// Time is virtual: a tick is raised either by SIGVTALRM, every PORT_POSIX_TICK_US
+// of host CPU time so that busy tasks get preempted, or by the idle task, which
+// skips straight to the next tick instead of waiting for it. With the tasks
+// blocked most of the time the simulation runs through thousands of ticks per
+// millisecond, and with PORT_POSIX_TICK_US set to 0 it is fully deterministic.
+//
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+#include "../../ktos.h"
+
+// Exception numbers of the Cortex-M3, reported by GetExceptionNumber.
+#define EXCEPTION_SVCALL 11
+#define EXCEPTION_PENDSV 14
+#define EXCEPTION_SYSTICK 15
+
+#define NS_PER_TICK (1000000000 / SYSTICK_FREQUENCY_HZ)
+
+// Kept at the top of the task stack, the rest of the stack is given to the context.
+typedef struct _port_context_t {
+    ucontext_t context;
+    void (*entry)(void *);
+    void *arg;
+    void (*exit)(void);
+} port_context_t;
+
+uint32_t SystemCoreClock = 72000000;
+
+volatile sig_atomic_t port_masked = 0;
+volatile sig_atomic_t port_exception = 0;
+volatile sig_atomic_t port_tick_pending = 0;
+volatile sig_atomic_t port_switch_pending = 0;
+
+static port_context_t *running_context = NULL;
+static uint64_t virtual_ticks = 0;
+static uint64_t tick_start_ns = 0; // host time when the current tick began
+
+
+static uint64_t GetHostNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+uint32_t PortGetCyclesPerTick(void) {
+    return SystemCoreClock / SYSTICK_FREQUENCY_HZ;
+}
+
+// The cycles within a tick follow the host clock, but stop short of the next tick,
+//   so that the virtual time never runs ahead of the ticks.
+uint32_t PortGetTickCycles(uint8_t *tick_pending) {
+    uint64_t elapsed_ns = GetHostNs() - tick_start_ns;
+    uint32_t cycles_per_tick = PortGetCyclesPerTick();
+
+    *tick_pending = 0;
+    if (elapsed_ns >= NS_PER_TICK) {
+        return cycles_per_tick - 1;
+    }
+    return (uint32_t) (elapsed_ns * cycles_per_tick / NS_PER_TICK);
+}
+
+uint32_t PortGetCycleCount(void) {
+    uint8_t tick_pending;
+    return (uint32_t) (virtual_ticks * PortGetCyclesPerTick()) + PortGetTickCycles(&tick_pending);
+}
+
+void PortInitCycleCounter(void) {
+    // Counted from the virtual ticks, nothing to set up.
+}
+
+
+// Context switch, as PendSV_Handler.
+static void SwitchContext(void) {
+    port_context_t *this_context = running_context;
+
+    // Not started yet.
+    if (this_context == NULL) {
+        return;
+    }
+    port_exception = EXCEPTION_PENDSV;
+    port_switch_pending = 0;
+    running_context = (port_context_t *) _ContextSwitcher((uint32_t *) this_context);
+    if (running_context != this_context) {
+        swapcontext(&this_context->context, &running_context->context);
+    }
+    // Switched back in.
+    port_exception = 0;
+}
+
+void PortServicePending(void) {
+    sig_atomic_t ticks;
+
+    do {
+        port_exception = EXCEPTION_SYSTICK;
+        while ((ticks = __atomic_exchange_n(&port_tick_pending, 0, __ATOMIC_SEQ_CST))) {
+            while (ticks--) {
+                virtual_ticks++;
+                tick_start_ns = GetHostNs();
+                _ktTickHandler();
+            }
+        }
+        port_exception = 0;
+
+        if (port_switch_pending) {
+            SwitchContext();
+        }
+    } while (port_tick_pending);
+}
+
+// A tick taken in a critical region or in a handler is left pending,
+//   otherwise it is served right here, switching tasks from the signal handler.
+static void TickSignalHandler(int signal) {
+    int saved_errno = errno;
+
+    (void) signal;
+    port_tick_pending++;
+    if (!port_masked && !port_exception) {
+        PortServicePending();
+    }
+    errno = saved_errno;
+}
+
+void PortInitTicker(void) {
+    tick_start_ns = GetHostNs();
+#if PORT_POSIX_TICK_US
+    struct sigaction action = {0};
+    action.sa_handler = TickSignalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGVTALRM, &action, NULL);
+
+    // Counted in the CPU time of the process, so a slow host (e.g. under the
+    // sanitizers) does not see more preemption than a fast one.
+    struct itimerval interval;
+    interval.it_interval.tv_sec = PORT_POSIX_TICK_US / 1000000;
+    interval.it_interval.tv_usec = PORT_POSIX_TICK_US % 1000000;
+    interval.it_value = interval.it_interval;
+    setitimer(ITIMER_VIRTUAL, &interval, NULL);
+#endif
+}
+
+// Nothing is ready, skip to the next tick.
+void PortIdle(void) {
+    __atomic_fetch_add(&port_tick_pending, 1, __ATOMIC_SEQ_CST);
+    PortServicePending();
+}
+
+// The syscall runs as the SVC handler would: the ticks and the switches it asks for
+//   are served on its return.
+int32_t PortSyscall(uint32_t code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3) {
+    port_exception = EXCEPTION_SVCALL;
+    int32_t result = _ktSyscall(code, arg1, arg2, arg3);
+    port_exception = 0;
+
+    if (port_tick_pending || port_switch_pending) {
+        PortServicePending();
+    }
+    return result;
+}
+
+
+static void TaskEntry(void) {
+    port_context_t *this_context = running_context;
+
+    // Returned from the handler that switched to this task.
+    port_exception = 0;
+    if (port_tick_pending || port_switch_pending) {
+        PortServicePending();
+    }
+
+    this_context->entry(this_context->arg);
+    this_context->exit();
+}
+
+uint32_t *PortInitStack(uint32_t *stack_bottom, uint32_t stack_size,
+                        void (*entry)(void *), void *arg, void (*exit)(void)) {
+    uintptr_t stack_end = (uintptr_t) (stack_bottom + 1);
+    uintptr_t stack_start = stack_end - stack_size;
+    port_context_t *this_context = (port_context_t *) ((stack_end - sizeof(port_context_t)) & ~(uintptr_t) 15);
+
+    getcontext(&this_context->context);
+    this_context->context.uc_stack.ss_sp = (void *) stack_start;
+    this_context->context.uc_stack.ss_size = (uintptr_t) this_context - stack_start;
+    this_context->context.uc_link = NULL;
+    sigemptyset(&this_context->context.uc_sigmask);
+    this_context->entry = entry;
+    this_context->arg = arg;
+    this_context->exit = exit;
+    makecontext(&this_context->context, TaskEntry, 0);
+
+    return (uint32_t *) this_context;
+}
+
+// Called by the SVC handler, which is left for good. The host stack of main() is not used again.
+void PortStartFirstTask(uint32_t *stack_top, volatile uint8_t *started) {
+    running_context = (port_context_t *) stack_top;
+    *started = 1;
+    setcontext(&running_context->context);
+}
@@ -0,0 +1,94 @@
+//
+// portmacro.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+// Host simulation primitives. The whole kernel runs in one host thread:
+//   tasks are ucontexts, the tick is SIGVTALRM, and the exception model of
+//   the Cortex-M3 is kept by flags, with PRIMASK and the active exception
+//   being port_masked and port_exception. A tick or a switch that comes while
+//   either is set is held pending, like the NVIC would, and served once both clear.
+//
+
+#ifndef KTOS_PORTMACRO_H
+#define KTOS_PORTMACRO_H
+
+#include <signal.h>
+#include <stdint.h>
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#endif
+
+#define PORT_HAS_LIBC 1
+
+// The host frames, signal frames and the ucontext all live on the task stack.
+#define PORT_STACK_SIZE(size) ((size) + PORT_POSIX_STACK_EXTRA)
+
+// Nominal core clock the virtual cycles are counted in.
+extern uint32_t SystemCoreClock;
+
+extern volatile sig_atomic_t port_masked;
+extern volatile sig_atomic_t port_exception;
+extern volatile sig_atomic_t port_tick_pending;
+extern volatile sig_atomic_t port_switch_pending;
+
+// Serve the pending ticks, then the pending switch.
+void PortServicePending(void);
+
+uint32_t PortGetCycleCount(void);
+
+void PortIdle(void);
+
+int32_t PortSyscall(uint32_t code, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
+
+static inline void PortYield(void) {
+    port_switch_pending = 1;
+    if (!port_masked && !port_exception) {
+        PortServicePending();
+    }
+}
+
+// The signal fences keep the compiler from moving accesses out of the critical region,
+//   the tick is delivered on this very thread so nothing stronger is needed.
+static inline void PortDisableInterrupts(void) {
+    port_masked = 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void PortEnableInterrupts(void) {
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    port_masked = 0;
+    if (!port_exception && (port_tick_pending || port_switch_pending)) {
+        PortServicePending();
+    }
+}
+
+static inline uint32_t PortMaskInterrupts(void) {
+    uint32_t masked = port_masked;
+    PortDisableInterrupts();
+    return masked;
+}
+
+static inline void PortRestoreInterrupts(uint32_t masked) {
+    if (!masked) {
+        PortEnableInterrupts();
+    }
+}
+
+// Called on the whole stack before the kernel paints it and PortInitStack lays it out.
+//   A heap block reused as a stack still carries the ASan poisoning of the frames
+//   of the killed task that had it, which were never returned from.
+static inline void PortPrepareStack(uint32_t *stack_end, uint32_t stack_size) {
+#if defined(__SANITIZE_ADDRESS__)
+    __asan_unpoison_memory_region(stack_end, stack_size);
+#else
+    (void) stack_end;
+    (void) stack_size;
+#endif
+}
+
+static inline uint32_t PortGetExceptionNumber(void) {
+    return port_exception;
+}
+
+#endif //KTOS_PORTMACRO_H
@@ -0,0 +1,36 @@
+//
+// profiler.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#include "profiler.h"
+#include "ktos.h"
+
+#if USE_PROFILER
+
+profiler_t ktos_profiler;
+
+void ProfilerStart(void) {
+    ktos_profiler.magic = PROFILER_MAGIC;
+    ktos_profiler.size = PROFILER_BUFFER_SIZE;
+    ktos_profiler.rate_hz = PROFILER_RATE_HZ;
+    ktos_profiler.head = 0;
+    
+    PortProfilerTimerStart(PROFILER_RATE_HZ);
+}
+
+void ProfilerStop(void) {
+    PortProfilerTimerStop();
+}
+
+// Record the PC interrupted by the profiler timer, called by its handler in the port.
+//   is_task is set if a task was interrupted, and cleared if it was an ISR.
+void _ProfilerSample(uint32_t pc, uint8_t is_task) {
+    uint32_t head = ktos_profiler.head;
+    ktos_profiler.pcs[head & (PROFILER_BUFFER_SIZE - 1)] = pc;
+    ktos_profiler.tasks[head & (PROFILER_BUFFER_SIZE - 1)] = is_task ? GetCurrentTaskPid() : PROFILER_NO_TASK;
+    ktos_profiler.head = head + 1;
+}
+
+#endif
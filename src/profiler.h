@@ -0,0 +1,36 @@
+//
+// profiler.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_PROFILER_H
+#define KTOS_PROFILER_H
+
+#include "types.h"
+#include "config.h"
+
+#if USE_PROFILER
+
+#define PROFILER_MAGIC 0x6b745043
+#define PROFILER_NO_TASK 0xff
+
+// The whole struct is dumped by the debugger and decoded by tools/pcprof.py.
+typedef struct _profiler_t {
+    uint32_t magic;
+    uint32_t size;          // PROFILER_BUFFER_SIZE
+    uint32_t rate_hz;       // PROFILER_RATE_HZ
+    volatile uint32_t head; // samples taken so far, the oldest ones get overwritten
+    uint32_t pcs[PROFILER_BUFFER_SIZE];
+    uint8_t tasks[PROFILER_BUFFER_SIZE]; // PROFILER_NO_TASK if an ISR was sampled
+} profiler_t;
+
+extern profiler_t ktos_profiler;
+
+void ProfilerStart(void);
+
+void ProfilerStop(void);
+
+#endif
+
+#endif //KTOS_PROFILER_H
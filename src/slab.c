@@ -0,0 +1,144 @@
+//
+// slab.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+// Slab caches for the kernel objects that are created at run time.
+//   A cache starts with the objects of its preallocated buffer, if any, and takes
+//   a slab of objects_per_slab more from the heap whenever it runs out, so that the
+//   number of objects follows the workload instead of a table size. The free objects
+//   of all the slabs are kept in one list, allocation and free are constant time.
+//   Slabs are not given back to the heap, the objects are expected to be reused.
+//   A cache with a slab table numbers its objects, so that an id is turned into its
+//   object in constant time, and the init method gives each object its number once.
+//
+
+#include "slab.h"
+#include "ktos.h"
+
+// Both of the list methods must be called inside a critical region.
+static void PushObject(slab_cache_t *cache, void *object) {
+    *(void **) object = cache->free_list;
+    cache->free_list = object;
+    cache->free_count++;
+}
+
+static void AddObjects(slab_cache_t *cache, char *buffer, uint32_t count) {
+    char *object;
+
+    // Pushed from the last one down, so that they are handed out in address order.
+    for (uint32_t i = count; i > 0; i--) {
+        object = buffer + (i - 1) * cache->object_size;
+        if (cache->init != NULL) {
+            cache->init(object, cache->object_count + i - 1);
+        }
+        PushObject(cache, object);
+    }
+    cache->object_count += count;
+}
+
+
+// The buffer holds buffer_count objects preallocated by the caller (8-byte aligned, with the
+//   object size rounded up to 8 bytes), it could be NULL. With objects_per_slab set to 0 the
+//   cache never grows past the buffer.
+void SlabCacheInit(slab_cache_t *cache, uint32_t object_size, uint32_t objects_per_slab,
+                   void *buffer, uint32_t buffer_count) {
+    SlabCacheInitIndexed(cache, object_size, objects_per_slab, buffer, buffer_count, NULL, 0, NULL);
+}
+
+// As SlabCacheInit, with the objects numbered for SlabObjectAt. The cache grows to no more than
+//   max_slab_count slabs, recorded in the slab_table given by the caller. init is called with
+//   each object and its number when the object is added, and the object keeps all but its first
+//   word while it is free.
+void SlabCacheInitIndexed(slab_cache_t *cache, uint32_t object_size, uint32_t objects_per_slab,
+                          void *buffer, uint32_t buffer_count,
+                          void **slab_table, uint32_t max_slab_count, SlabObjectInit init) {
+    // Each object has to hold the link of the free list.
+    object_size = Align(object_size);
+    if (object_size < sizeof(void *)) {
+        object_size = Align(sizeof(void *));
+    }
+
+    EnterCritical();
+    cache->free_list = NULL;
+    cache->object_size = object_size;
+    cache->objects_per_slab = objects_per_slab;
+    cache->object_count = 0;
+    cache->free_count = 0;
+    cache->max_used_count = 0;
+    cache->slab_count = 0;
+    cache->failed_count = 0;
+    cache->buffer = (char *) buffer;
+    cache->buffer_count = buffer != NULL ? buffer_count : 0;
+    cache->slab_table = slab_table;
+    cache->max_slab_count = max_slab_count;
+    cache->init = init;
+    if (buffer != NULL) {
+        AddObjects(cache, (char *) buffer, buffer_count);
+    }
+    LeaveCritical();
+}
+
+// Could be called from ISRs, a new slab is taken from the heap in constant time as well.
+void *SlabAlloc(slab_cache_t *cache) {
+    EnterCritical();
+    if (cache->free_list == NULL && cache->objects_per_slab &&
+        (cache->slab_table == NULL || cache->slab_count < cache->max_slab_count)) {
+        mem_block_header_t *slab = AllocateMemBlock(cache->object_size * cache->objects_per_slab);
+        if (slab != NULL) {
+            if (cache->slab_table != NULL) {
+                cache->slab_table[cache->slab_count] = (char *) slab + HEADER_SIZE;
+            }
+            AddObjects(cache, (char *) slab + HEADER_SIZE, cache->objects_per_slab);
+            cache->slab_count++;
+        }
+    }
+
+    void *object = cache->free_list;
+    if (object == NULL) {
+        cache->failed_count++;
+        LeaveCritical();
+        return NULL;
+    }
+    cache->free_list = *(void **) object;
+    cache->free_count--;
+    if (cache->object_count - cache->free_count > cache->max_used_count) {
+        cache->max_used_count = cache->object_count - cache->free_count;
+    }
+    LeaveCritical();
+    return object;
+}
+
+void SlabFree(slab_cache_t *cache, void *object) {
+    EnterCritical();
+    PushObject(cache, object);
+    LeaveCritical();
+}
+
+// The object numbered index, free or not, NULL if the cache has not grown that far.
+//   only for the caches with a slab table.
+void *SlabObjectAt(slab_cache_t *cache, uint32_t index) {
+    if (index < cache->buffer_count) {
+        return cache->buffer + index * cache->object_size;
+    }
+    if (cache->slab_table == NULL || cache->objects_per_slab == 0) {
+        return NULL;
+    }
+    index -= cache->buffer_count;
+    uint32_t slab = index / cache->objects_per_slab;
+    if (slab >= cache->slab_count) {
+        return NULL;
+    }
+    return (char *) cache->slab_table[slab] + (index % cache->objects_per_slab) * cache->object_size;
+}
+
+void SlabCacheGetStats(slab_cache_t *cache, slab_stats_t *stats) {
+    EnterCritical();
+    stats->object_size = cache->object_size;
+    stats->object_count = cache->object_count;
+    stats->used_count = cache->object_count - cache->free_count;
+    stats->max_used_count = cache->max_used_count;
+    stats->slab_count = cache->slab_count;
+    stats->failed_count = cache->failed_count;
+    LeaveCritical();
+}
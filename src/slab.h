@@ -0,0 +1,31 @@
+//
+// slab.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_SLAB_H
+#define KTOS_SLAB_H
+
+#include "types.h"
+#include "config.h"
+
+// Bytes of the buffer preallocated for SlabCacheInit, the objects are rounded up to 8 bytes.
+#define SLAB_BUFFER_SIZE(object_size, object_count) ((((object_size) + 7) & ~7) * (object_count))
+
+void SlabCacheInit(slab_cache_t *cache, uint32_t object_size, uint32_t objects_per_slab,
+                   void *buffer, uint32_t buffer_count);
+
+void SlabCacheInitIndexed(slab_cache_t *cache, uint32_t object_size, uint32_t objects_per_slab,
+                          void *buffer, uint32_t buffer_count,
+                          void **slab_table, uint32_t max_slab_count, SlabObjectInit init);
+
+void *SlabAlloc(slab_cache_t *cache);
+
+void SlabFree(slab_cache_t *cache, void *object);
+
+void *SlabObjectAt(slab_cache_t *cache, uint32_t index);
+
+void SlabCacheGetStats(slab_cache_t *cache, slab_stats_t *stats);
+
+#endif //KTOS_SLAB_H
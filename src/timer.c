@@ -0,0 +1,212 @@
+//
+// timer.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#include "timer.h"
+#include "ktos.h"
+#include "slab.h"
+
+// Timer control block, taken from a slab cache of TIMER_SLAB_OBJECTS timers per slab. The first
+//   slab is static, the others are taken from the heap once all of the timers are in use.
+//   the id of a timer is its number in the cache, so that it is looked up in constant time,
+//   and only the 8 bits of the ids limit the number of timers.
+#define MAX_TIMER_SLAB_COUNT (TIMER_NOT_BEING_USED / TIMER_SLAB_OBJECTS - 1)
+
+static uint64_t first_timer_slab[SLAB_BUFFER_SIZE(sizeof(soft_timer_t), TIMER_SLAB_OBJECTS) / 8];
+static void *timer_slabs[MAX_TIMER_SLAB_COUNT];
+static slab_cache_t timer_cache;
+// Active timers, sorted by expiry (the head expires first).
+static soft_timer_t *active_timers = NULL;
+
+
+// Timers not in use have no callback.
+static soft_timer_t *GetTimer(uint8_t timer_id) {
+    soft_timer_t *this_timer = SlabObjectAt(&timer_cache, timer_id);
+    if (this_timer == NULL || this_timer->callback == NULL) {
+        return NULL;
+    }
+    return this_timer;
+}
+
+// Called by the cache once for each timer, as its slab is added.
+static void InitTimer(void *object, uint32_t index) {
+    soft_timer_t *this_timer = object;
+    this_timer->id = (uint8_t) index;
+    this_timer->callback = NULL;
+    this_timer->active = 0;
+}
+
+// Both of the list methods must be called inside a critical region.
+static void InsertTimer(soft_timer_t *this_timer) {
+    soft_timer_t **link = &active_timers;
+    
+    // Timers with the same expiry keep the order they were started in.
+    while (*link != NULL && TimeReached(this_timer->expiry, (*link)->expiry)) {
+        link = &(*link)->next;
+    }
+    this_timer->next = *link;
+    *link = this_timer;
+    this_timer->active = 1;
+}
+
+static void RemoveTimer(soft_timer_t *this_timer) {
+    soft_timer_t **link = &active_timers;
+    
+    while (*link != NULL) {
+        if (*link == this_timer) {
+            *link = this_timer->next;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    this_timer->next = NULL;
+    this_timer->active = 0;
+}
+
+
+void InitTimerControlBlock(void) {
+    active_timers = NULL;
+    SlabCacheInitIndexed(&timer_cache, sizeof(soft_timer_t), TIMER_SLAB_OBJECTS,
+                         first_timer_slab, TIMER_SLAB_OBJECTS,
+                         timer_slabs, MAX_TIMER_SLAB_COUNT, InitTimer);
+}
+
+int TimerCreate(TimerCallback callback, void *arg, uint32_t period, uint8_t auto_reload, uint8_t *timer_id) {
+    if (callback == NULL || period == 0 || period == NO_TIMEOUT) {
+        return TIMER_INVALID;
+    }
+    
+    EnterCritical();
+    soft_timer_t *this_timer = SlabAlloc(&timer_cache);
+    if (this_timer == NULL) {
+        LeaveCritical();
+        return TIMER_AMOUNT_MAXIMUM_EXCEEDED;
+    }
+    
+    this_timer->auto_reload = auto_reload;
+    this_timer->active = 0;
+    this_timer->period = MsToTicks(period);
+    this_timer->callback = callback;
+    this_timer->arg = arg;
+    this_timer->next = NULL;
+    *timer_id = this_timer->id;
+    LeaveCritical();
+    return TIMER_OK;
+}
+
+int TimerDelete(uint8_t timer_id) {
+    EnterCritical();
+    soft_timer_t *this_timer = GetTimer(timer_id);
+    if (this_timer == NULL) {
+        LeaveCritical();
+        return TIMER_INVALID;
+    }
+    
+    if (this_timer->active) {
+        RemoveTimer(this_timer);
+    }
+    this_timer->callback = NULL;
+    SlabFree(&timer_cache, this_timer);
+    LeaveCritical();
+    return TIMER_OK;
+}
+
+// Start, stop and reset only touch the timer list inside a critical region,
+// so that they could be called from both tasks and ISRs.
+int TimerStart(uint8_t timer_id) {
+    EnterCritical();
+    soft_timer_t *this_timer = GetTimer(timer_id);
+    if (this_timer == NULL) {
+        LeaveCritical();
+        return TIMER_INVALID;
+    }
+    
+    // A running timer keeps its current expiry.
+    if (!this_timer->active) {
+        this_timer->expiry = GetTickCount() + this_timer->period;
+        InsertTimer(this_timer);
+    }
+    LeaveCritical();
+    return TIMER_OK;
+}
+
+int TimerStop(uint8_t timer_id) {
+    EnterCritical();
+    soft_timer_t *this_timer = GetTimer(timer_id);
+    if (this_timer == NULL) {
+        LeaveCritical();
+        return TIMER_INVALID;
+    }
+    
+    if (this_timer->active) {
+        RemoveTimer(this_timer);
+    }
+    LeaveCritical();
+    return TIMER_OK;
+}
+
+int TimerReset(uint8_t timer_id) {
+    EnterCritical();
+    soft_timer_t *this_timer = GetTimer(timer_id);
+    if (this_timer == NULL) {
+        LeaveCritical();
+        return TIMER_INVALID;
+    }
+    
+    if (this_timer->active) {
+        RemoveTimer(this_timer);
+    }
+    this_timer->expiry = GetTickCount() + this_timer->period;
+    InsertTimer(this_timer);
+    LeaveCritical();
+    return TIMER_OK;
+}
+
+
+void TimerGetSlabStats(slab_stats_t *stats) {
+    SlabCacheGetStats(&timer_cache, stats);
+}
+
+
+// Called by SysTick_Handler every tick, only the head of the list has to be checked.
+uint8_t _TimerHasExpired(uint32_t now) {
+    return active_timers != NULL && TimeReached(now, active_timers->expiry);
+}
+
+// All of the callbacks are executed in this task,
+// it will be notified by SysTick_Handler once the first timer expired.
+void _TimerDaemonTask(void) {
+    soft_timer_t *this_timer;
+    TimerCallback callback;
+    void *arg;
+    uint8_t timer_id;
+    
+    while (1) {
+        EnterCritical();
+        this_timer = active_timers;
+        if (this_timer != NULL && TimeReached(GetTickCount(), this_timer->expiry)) {
+            active_timers = this_timer->next;
+            this_timer->next = NULL;
+            if (this_timer->auto_reload) {
+                // Reload from the last expiry so that the period does not drift.
+                this_timer->expiry += this_timer->period;
+                InsertTimer(this_timer);
+            } else {
+                this_timer->active = 0;
+            }
+            callback = this_timer->callback;
+            arg = this_timer->arg;
+            timer_id = this_timer->id;
+            LeaveCritical();
+            
+            TRACE(TRACE_TIMER_EXPIRE, TRACE_NO_TASK, timer_id);
+            callback(timer_id, arg);
+            continue;
+        }
+        LeaveCritical();
+        
+        TaskNotifyWait(NO_TIMEOUT);
+    }
+}
@@ -0,0 +1,31 @@
+//
+// timer.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_TIMER_H
+#define KTOS_TIMER_H
+
+#include "types.h"
+#include "config.h"
+
+void InitTimerControlBlock(void);
+
+int TimerCreate(TimerCallback callback, void *arg, uint32_t period, uint8_t auto_reload, uint8_t *timer_id);
+
+int TimerDelete(uint8_t timer_id);
+
+int TimerStart(uint8_t timer_id);
+
+int TimerStop(uint8_t timer_id);
+
+int TimerReset(uint8_t timer_id);
+
+void TimerGetSlabStats(slab_stats_t *stats);
+
+uint8_t _TimerHasExpired(uint32_t now);
+
+void _TimerDaemonTask(void);
+
+#endif //KTOS_TIMER_H
@@ -0,0 +1,20 @@
+//
+// trace.c @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#include "trace.h"
+
+#if USE_TRACE
+
+trace_t ktos_trace;
+
+void InitTrace(void) {
+    ktos_trace.magic = TRACE_MAGIC;
+    ktos_trace.size = TRACE_BUFFER_SIZE;
+    ktos_trace.core_clock = SystemCoreClock;
+    ktos_trace.head = 0;
+}
+
+#endif
@@ -0,0 +1,54 @@
+//
+// trace.h @ ktOS
+//
+// Created by Kotorinyanya.
+//
+
+#ifndef KTOS_TRACE_H
+#define KTOS_TRACE_H
+
+#include "types.h"
+#include "config.h"
+#include "clock.h"
+
+#if USE_TRACE
+
+#define TRACE_MAGIC 0x6b745452
+
+// The whole struct is dumped by the debugger and decoded by tools/trace2chrome.py.
+typedef struct _trace_t {
+    uint32_t magic;
+    uint32_t size;          // TRACE_BUFFER_SIZE
+    uint32_t core_clock;    // cycles per second
+    volatile uint32_t head; // records written so far, the oldest ones get overwritten
+    trace_record_t records[TRACE_BUFFER_SIZE];
+} trace_t;
+
+extern trace_t ktos_trace;
+
+void InitTrace(void);
+
+// Append a record, it could be called from tasks and ISRs.
+//   PRIMASK is saved and restored inline instead of calling EnterCritical,
+//   so that this costs only a dozen of cycles.
+static inline void TraceEvent(uint8_t event, uint8_t task, uint16_t arg) {
+    uint32_t primask = PortMaskInterrupts();
+    
+    trace_record_t *record = ktos_trace.records + (ktos_trace.head++ & (TRACE_BUFFER_SIZE - 1));
+    record->cycles = GetCycleCount();
+    record->event = event;
+    record->task = task;
+    record->arg = arg;
+    
+    PortRestoreInterrupts(primask);
+}
+
+#define TRACE(event, task, arg) TraceEvent((event), (uint8_t) (task), (uint16_t) (arg))
+
+#else
+
+#define TRACE(event, task, arg)
+
+#endif
+
+#endif //KTOS_TRACE_H
@@ -7,15 +7,24 @@
 #ifndef KTOS_TYPES_H
 #define KTOS_TYPES_H
 
-#include "../CMSIS/CM3/DeviceSupport/ST/STM32F10x/stm32f10x.h"
+#include "port.h"
 #include "heap.h"
 #include "config.h"
 
 #define NO_TIMEOUT 0xffffffff
+#ifndef NULL
 #define NULL 0x0
+#endif
 #define HEADER_SIZE sizeof(mem_block_header_t)
 
 typedef void(*TaskFunction)(void *);
+// pid in the low byte, and the generation of the task control block in the high byte,
+//   so that a handle kept after the task was killed does not reach the next task given its pid.
+typedef uint16_t task_handle_t;
+
+typedef void(*TimerCallback)(uint8_t timer_id, void *arg);
+
+typedef void(*SlabObjectInit)(void *object, uint32_t index);
 
 typedef enum STATUS_CODE {
 /*******  Task Status Code Definitions **************************************************************/
@@ -25,6 +34,8 @@ typedef enum STATUS_CODE {
     TASK_STATE_WAIT_TO_SENT_QUEUE = 4,    /*!< task was blocked on pushing data to queue */
     TASK_STATE_WAIT_TO_RECEIVE_QUEUE = 5,    /*!< task was blocked on pulling data from queue */
     TASK_STATE_RUNNING = 6,    /*!< task executing */
+    TASK_STATE_WAIT_NOTIFY = 27,   /*!< task blocked until notified */
+    TASK_STATE_WAIT_OBJECT = 38,   /*!< task blocked on a kernel object (e.g. a block pool) */
 
 /*******  Queue Status Code Definitions *************************************************************/
             QUEUE_EMPTY = 7,    /*!< queue empty */
@@ -34,7 +45,10 @@ typedef enum STATUS_CODE {
     QUEUE_RECEIVE_OK = 11,   /*!< succeeded to pull data from queue */
     QUEUE_RECEIVE_FAILED = 12,   /*!< failed to pull data from queue */
     TASK_WITH_NO_QUEUE = 255,    /*!< task do not have a queue with it */
-    QUEUE_CONTROL_BLOCK_NOT_BEING_USED = 255
+    QUEUE_CONTROL_BLOCK_NOT_BEING_USED = 255,
+    TIMER_NOT_BEING_USED = 255,
+    BLOCK_POOL_NOT_BEING_USED = 255,
+    MEM_BLOCK_NO_OWNER = 255
 } STATUS_CODE_DEF;
 
 typedef enum RETURN_CODE {
@@ -47,7 +61,14 @@ typedef enum RETURN_CODE {
     TASK_OK = 18,   /*!< succeeded to create task */
     TASK_AMOUNT_MAXIMUM_EXCEEDED = 19,   /*!< too many tasks */
     TASK_ALLOCATE_STACK_FAILED = 20,   /*!< bad stack size(not aligned to 8-byte) */
-    MEM_POOL_MAXIMUM_EXCEEDED = 21    /*!< not enough memory */
+    MEM_POOL_MAXIMUM_EXCEEDED = 21,   /*!< not enough memory */
+    TIMER_OK = 28,   /*!< timer operation successful */
+    TIMER_AMOUNT_MAXIMUM_EXCEEDED = 29,   /*!< too many timers */
+    TIMER_INVALID = 30,   /*!< timer id not in use */
+    BLOCK_POOL_OK = 34,   /*!< block pool operation successful */
+    BLOCK_POOL_AMOUNT_MAXIMUM_EXCEEDED = 35,   /*!< too many block pools */
+    BLOCK_POOL_INVALID = 36,   /*!< pool id not in use, or block not of the pool */
+    TASK_INVALID_HANDLE = 37    /*!< task already killed, or the idle task */
 } RETURN_CODE_DEF;
 
 typedef enum SYSCALL_CODE {
@@ -56,14 +77,18 @@ typedef enum SYSCALL_CODE {
     SYSCALL_TASK_SLEEP = 23,
     SYSCALL_TASK_KILL = 24,
     SYSCALL_SEND_TO_QUEUE = 25,
-    SYSCALL_RECEIVE_FROM_QUEUE = 26
+    SYSCALL_RECEIVE_FROM_QUEUE = 26,
+    SYSCALL_TASK_NOTIFY_WAIT = 31,
+    SYSCALL_TASK_SLEEP_US = 32,
+    SYSCALL_TASK_SLEEP_UNTIL = 33,
+    SYSCALL_TASK_OBJECT_WAIT = 39
 } SYSCALL_CODE_DEF;
 
 
 // Stack frame that is saved by the hardware (automatically)
 typedef struct _hardware_stack_frame_t {
     uint32_t r0;
-    uint8_t r1;
+    uint32_t r1;
     uint32_t r2;
     uint32_t r3;
     uint32_t r12;
@@ -84,27 +109,81 @@ typedef struct _software_stack_frame_t {
     uint32_t r11;
 } software_stack_frame_t;
 
-// Memory block for the stack of task.
+// Memory block of the heap, followed by its payload.
+//   sizeof must stay a multiple of 8, so that the payloads are aligned to 8 bytes.
 typedef struct _mem_block_header_t mem_block_header_t;
 struct _mem_block_header_t {
-    uint32_t size;
-    struct _mem_block_header_t *next_block;
-    struct _mem_block_header_t *past_block;
-    uint32_t *stack_bottom;
+    struct _mem_block_header_t *prev_physical; // the block just below, NULL for the first one
+    uint32_t *stack_bottom;                    // last word of the payload
+    uint32_t size;                             // bytes of payload, a multiple of 8
+    uint8_t is_free;
+    uint8_t owner;                             // pid of the task it was allocated for, or MEM_BLOCK_NO_OWNER
+    uint8_t owner_generation;                  // of the owner, to tell it from the next task given the pid
 };
 
+// Links of a free block to its free list, kept in the payload as it is unused then.
+typedef struct _mem_free_links_t {
+    mem_block_header_t *next_free;
+    mem_block_header_t *past_free;
+} mem_free_links_t;
+
+// Heap statistics, all sizes are in bytes of payload.
+typedef struct _heap_stats_t {
+    uint32_t used_bytes;
+    uint32_t free_bytes;
+    uint32_t largest_free;  // the largest free block
+    uint32_t min_free_bytes; // low-water mark of free_bytes
+    uint32_t used_count;    // blocks allocated
+    uint32_t free_count;    // free blocks
+    uint32_t failed_count;  // allocations that found no block large enough
+} heap_stats_t;
+
+typedef struct _heap_block_info_t {
+    uint32_t offset; // of the header in mem_pool
+    uint32_t size;
+    uint8_t is_free;
+    uint8_t owner;
+} heap_block_info_t;
+
 // Task control block definitions.
+//   the fields read by the tick and the context switch come first, packed in
+//   the first 16 bytes (on 32-bit), the rest is only touched by the API.
 typedef struct _task_control_block_t {
-    char name[TASK_NAME_SIZE];
-    uint8_t pid;
+    uint32_t *stack_top;
+    uint32_t wake_time; // tick to wake up at, or NO_TIMEOUT
+    uint32_t wake_slack; // ticks the wake up could be delayed by
     uint8_t status;
     uint8_t priority;
-    uint32_t sleep_time;
-    uint32_t stack_size;
-    mem_block_header_t *mem_block;
-    uint32_t *stack_top;
-    uint32_t *stack_bottom;
+    uint8_t notified;
     uint8_t queue_id;
+    // Cold.
+    uint32_t *stack_bottom;
+    mem_block_header_t *mem_block;
+    const char *name; // not copied, it is expected to be a string literal in flash
+    uint32_t slack; // default slack of the sleeps and timeouts
+    uint32_t stack_size;
+#if USE_TASK_ARENA
+    mem_block_header_t *arena; // NULL if the task has none
+    uint32_t arena_used; // bytes handed out from the start of the arena
+#endif
+#if USE_STACK_PAINTING
+    uint32_t stack_free_words; // words at the far end of the stack never written, the high-water mark
+    uint32_t stack_scan_words; // where the idle task is scanning, from the far end
+#endif
+#if USE_RUNTIME_STATS
+    uint64_t run_cycles;
+    uint32_t window_start_run; // low word of run_cycles when the window began
+    uint16_t window_usage; // share in the last window, in 0.01%
+#endif
+#if USE_LATENCY_STATS
+    uint32_t ready_cycles; // when it was woken by an ISR, 0 if not
+    uint32_t release_tick; // nominal release of TaskSleepUntil
+    uint8_t release_pending;
+#endif
+    struct _task_control_block_t *next_free; // link of the free list while not in use
+    uint8_t pid; // index of the task control block, reused once the task is killed
+    uint8_t generation; // bumped each time the task is killed
+    uint8_t object_woken; // woken by a kernel object before waiting on it, kept apart from notified
     //software_stack_frame_t software_stack_frame;
 } task_control_block_t;
 //const task_control_block_t task_control_block_default = {
@@ -112,7 +191,7 @@ typedef struct _task_control_block_t {
 //        .pid = (uint8_t) -1,
 //        .status = TASK_STATE_KILLED,
 //        .priority = (uint8_t) -1,
-//        .sleep_time = 0,
+//        .wake_time = NO_TIMEOUT,
 //        .stack_size = 0,
 //        .mem_block = NULL,
 //        .queue_id = TASK_WITH_NO_QUEUE,
@@ -130,9 +209,130 @@ typedef struct _queue_t {
 
 
 // Queue control block definitions.
+//   taken from a slab cache when an id is first used, and kept in a table indexed by id.
 typedef struct _queue_control_block_t {
     uint8_t id;
     queue_t queues[QUEUE_SIZE];
 } queue_control_block_t;
 
+// Software timer definitions.
+//   active timers are linked in ascending order of expiry.
+//   next comes first, the slab cache links the free timers through it and keeps the rest.
+typedef struct _soft_timer_t {
+    struct _soft_timer_t *next;
+    uint8_t id;
+    uint8_t auto_reload;
+    uint8_t active;
+    uint32_t period;
+    uint32_t expiry;
+    TimerCallback callback;
+    void *arg;
+} soft_timer_t;
+
+// Fixed-size block pool definitions.
+//   the free blocks are linked through their first word.
+typedef struct _block_pool_t {
+    uint8_t id;
+    void *free_list;
+    char *start;             // first block, the blocks are block_size apart
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t free_count;
+    uint32_t min_free_count; // low-water mark of free_count
+    uint32_t failed_count;   // allocations that found the pool empty
+    uint32_t waiting;        // bitmap of the pids blocked on the pool
+    mem_block_header_t *mem_block; // the blocks when carved from the heap, NULL if not
+} block_pool_t;
+
+typedef struct _block_pool_stats_t {
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t used_count;
+    uint32_t max_used_count;
+    uint32_t failed_count;
+} block_pool_stats_t;
+
+// Slab cache definitions.
+//   objects of one size, taken from slabs of objects_per_slab objects carved
+//   from the heap as needed, after the preallocated ones given at init.
+//   the free objects are linked through their first word.
+//   with a slab table the objects are numbered, the preallocated ones first.
+typedef struct _slab_cache_t {
+    void *free_list;
+    uint32_t object_size;
+    uint32_t objects_per_slab;
+    char *buffer;            // the preallocated objects
+    uint32_t buffer_count;
+    void **slab_table;       // first object of each slab, NULL if the objects are not numbered
+    uint32_t max_slab_count; // size of the slab table
+    SlabObjectInit init;     // called once for each object as it is added, could be NULL
+    uint32_t object_count;   // in the preallocated buffer and in all of the slabs
+    uint32_t free_count;
+    uint32_t max_used_count; // high-water mark of the objects in use
+    uint32_t slab_count;     // slabs taken from the heap
+    uint32_t failed_count;   // allocations that found no object and no heap for a slab
+} slab_cache_t;
+
+typedef struct _slab_stats_t {
+    uint32_t object_size;
+    uint32_t object_count;
+    uint32_t used_count;
+    uint32_t max_used_count;
+    uint32_t slab_count;
+    uint32_t failed_count;
+} slab_stats_t;
+
+// Trace definitions.
+//   the codes are part of the dump format, keep them in sync with tools/trace2chrome.py.
+typedef enum TRACE_EVENT_CODE {
+    TRACE_TASK_SWITCH = 1,    /*!< task switched in, arg: the task switched out */
+    TRACE_SYSCALL = 2,    /*!< syscall entered, arg: syscall code */
+    TRACE_QUEUE_SEND = 3,    /*!< arg: queue id */
+    TRACE_QUEUE_RECEIVE = 4,    /*!< arg: queue id */
+    TRACE_QUEUE_BLOCK = 5,    /*!< task blocked on a queue, arg: queue id */
+    TRACE_ISR_ENTER = 6,    /*!< arg: exception number */
+    TRACE_ISR_EXIT = 7,    /*!< arg: exception number */
+    TRACE_TICK = 8,    /*!< arg: low half of systicks */
+    TRACE_TIMER_EXPIRE = 9,    /*!< timer callback about to run, arg: timer id */
+    TRACE_NO_TASK = 0xff
+} TRACE_EVENT_CODE_DEF;
+
+typedef struct _trace_record_t {
+    uint32_t cycles;
+    uint8_t event;
+    uint8_t task;
+    uint16_t arg;
+} trace_record_t;
+
+// Histogram definitions.
+//   bucket n counts the samples of [2^n, 2^(n+1)) cycles, the last one takes the rest.
+typedef struct _histogram_t {
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+} histogram_t;
+
+typedef enum HISTOGRAM_CODE {
+    HISTOGRAM_WAKE_LATENCY = 0,   /*!< ISR waking a task to the task running */
+    HISTOGRAM_RELEASE_JITTER = 1,   /*!< nominal release of TaskSleepUntil to the task running */
+    HISTOGRAM_CRITICAL = 2,   /*!< interrupts masked by EnterCritical */
+    HISTOGRAM_COUNT = 3
+} HISTOGRAM_CODE_DEF;
+
+// Critical region profiler definitions.
+typedef struct _critical_site_t {
+    uint32_t site;       // return address of the outermost EnterCritical
+    uint32_t max_cycles;
+    uint32_t count;
+} critical_site_t;
+
+// Log buffer definitions.
+//   each buffer has a single writer and the log task as its single reader.
+typedef struct _log_buffer_t {
+    volatile uint16_t head; // written by the writer only
+    volatile uint16_t tail; // written by the log task only
+    uint16_t dropped;       // bytes lost because the buffer was full
+    char data[LOG_BUFFER_SIZE];
+} log_buffer_t;
+
 #endif //KTOS_TYPES_H
@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+#
+# binlog.py @ ktOS
+#
+# Decode a dump of ktos_binlog, with the format strings of LOGB read back from the ELF.
+#
+# Build with USE_BINLOG set to 1 in src/config.h, then dump the buffer with gdb:
+#     (gdb) dump binary value binlog.bin ktos_binlog
+# and decode it:
+#     ./tools/binlog.py ktos.elf binlog.bin
+#
+
+import argparse
+import re
+import struct
+import sys
+
+BINLOG_MAGIC = 0x6b74424c
+BINLOG_MARKER = 0xa5
+BINLOG_MAX_ARGS = 6
+HEADER = struct.Struct('<IIII')
+STRINGS_SECTION = '.ktos_log_strings'
+SHF_ALLOC = 0x2
+SHT_SYMTAB = 2
+STT_FUNC = 2
+SPEC = re.compile(r'%([-+ 0#]*\d*(?:\.\d+)?)(?:l|ll|h|hh)?([diuxXcsp%])')
+
+
+class Elf32(object):
+    def __init__(self, data):
+        if data[:4] != b'\x7fELF' or data[4] != 1:
+            sys.exit('not an ELF32 file')
+        self.data = data
+        shoff, = struct.unpack_from('<I', data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x2e)
+        self.headers = [struct.unpack_from('<IIIIIIIIII', data, shoff + i * shentsize) for i in range(shnum)]
+        names = self.headers[shstrndx]
+        self.sections = {}
+        for name, sh_type, flags, addr, offset, size in (h[:6] for h in self.headers):
+            self.sections[self._cstring(names[4] + name)] = (flags, addr, offset, size)
+
+    def _cstring(self, offset):
+        end = self.data.index(b'\0', offset)
+        return self.data[offset:end].decode('utf-8', 'replace')
+
+    def section_string(self, section, offset):
+        flags, addr, file_offset, size = self.sections[section]
+        if offset >= size:
+            return None
+        return self._cstring(file_offset + offset)
+
+    # Function symbols as (address, size, name), sorted by address.
+    def functions(self):
+        result = []
+        for sh_type, offset, size, link, entsize in ((h[1], h[4], h[5], h[6], h[9]) for h in self.headers):
+            if sh_type != SHT_SYMTAB:
+                continue
+            strtab = self.headers[link][4]
+            for n in range(size // entsize):
+                name, value, sym_size, info = struct.unpack_from('<IIIB', self.data, offset + n * entsize)
+                if info & 0xf == STT_FUNC:
+                    # Bit 0 of a thumb function address is set.
+                    result.append((value & ~1, sym_size, self._cstring(strtab + name)))
+        return sorted(result)
+
+    # Strings passed to %s have to be placed in one of the loaded sections (flash).
+    def string_at(self, address):
+        for flags, addr, offset, size in self.sections.values():
+            if flags & SHF_ALLOC and addr <= address < addr + size:
+                return self._cstring(offset + address - addr)
+        return '<0x%08x>' % address
+
+
+def to_signed(value):
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def render(elf, text, args):
+    args = list(args)
+
+    def substitute(match):
+        flags, conversion = match.groups()
+        if conversion == '%':
+            return '%'
+        if not args:
+            return match.group(0)
+        value = args.pop(0)
+        if conversion in 'di':
+            return ('%' + flags + 'd') % to_signed(value)
+        if conversion == 'u':
+            return ('%' + flags + 'd') % value
+        if conversion in 'xX':
+            return ('%' + flags + conversion) % value
+        if conversion == 'p':
+            return '0x%08x' % value
+        if conversion == 'c':
+            return chr(value & 0xff)
+        return ('%' + flags + 's') % elf.string_at(value)
+
+    return SPEC.sub(substitute, text)
+
+
+def read_words(data):
+    magic, size, core_clock, head = HEADER.unpack_from(data, 0)
+    if magic != BINLOG_MAGIC:
+        sys.exit('not a ktos_binlog dump (magic 0x%08x)' % magic)
+    count = min(head, size)
+    words = [struct.unpack_from('<I', data, HEADER.size + (n % size) * 4)[0] for n in range(head - count, head)]
+    # Once the buffer wrapped, it may start in the middle of a record.
+    return core_clock, words, head > size
+
+
+def decode(elf, core_clock, words, resync):
+    n = 0
+    last = None
+    base = 0
+    while n + 2 <= len(words):
+        header = words[n]
+        arg_count = (header >> 16) & 0xff
+        if header >> 24 != BINLOG_MARKER or arg_count > BINLOG_MAX_ARGS or n + 2 + arg_count > len(words):
+            if not resync:
+                sys.exit('corrupted record at word %d' % n)
+            n += 1
+            continue
+        text = elf.section_string(STRINGS_SECTION, header & 0xffff)
+        if text is None:
+            n += 1
+            continue
+        resync = False
+
+        cycles = words[n + 1]
+        if last is not None and cycles < last:
+            base += 1 << 32
+        last = cycles
+        args = words[n + 2:n + 2 + arg_count]
+        n += 2 + arg_count
+
+        yield (base + cycles) * 1e6 / core_clock, render(elf, text, args)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a ktOS binary log dump.')
+    parser.add_argument('elf', help='the firmware, e.g. ktos.elf')
+    parser.add_argument('dump', help='binary dump of ktos_binlog')
+    args = parser.parse_args()
+
+    with open(args.elf, 'rb') as f:
+        elf = Elf32(f.read())
+    if STRINGS_SECTION not in elf.sections:
+        sys.exit('%s has no %s section' % (args.elf, STRINGS_SECTION))
+    with open(args.dump, 'rb') as f:
+        core_clock, words, resync = read_words(f.read())
+
+    for timestamp, text in decode(elf, core_clock, words, resync):
+        sys.stdout.write('[%12.3f us] %s' % (timestamp, text))
+        if not text.endswith('\n'):
+            sys.stdout.write('\n')
+
+
+if __name__ == '__main__':
+    main()
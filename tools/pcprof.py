@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+#
+# pcprof.py @ ktOS
+#
+# Turn a dump of ktos_profiler into a flat profile per task, symbolized against the ELF.
+#
+# Build with USE_PROFILER set to 1 in src/config.h, call ProfilerStart, then dump the buffer with gdb:
+#     (gdb) dump binary value pcprof.bin ktos_profiler
+# and symbolize it:
+#     ./tools/pcprof.py ktos.elf pcprof.bin --names 0=foo,1=bar
+#
+
+import argparse
+import bisect
+import collections
+import struct
+import sys
+
+from binlog import Elf32
+
+PROFILER_MAGIC = 0x6b745043
+PROFILER_NO_TASK = 0xff
+HEADER = struct.Struct('<IIII')
+
+
+def read_samples(data):
+    magic, size, rate_hz, head = HEADER.unpack_from(data, 0)
+    if magic != PROFILER_MAGIC:
+        sys.exit('not a ktos_profiler dump (magic 0x%08x)' % magic)
+    tasks_offset = HEADER.size + size * 4
+    count = min(head, size)
+    samples = []
+    for n in range(head - count, head):
+        pc, = struct.unpack_from('<I', data, HEADER.size + (n % size) * 4)
+        samples.append((pc, data[tasks_offset + n % size]))
+    return rate_hz, samples
+
+
+def symbolize(functions, pc):
+    starts = [f[0] for f in functions]
+    n = bisect.bisect_right(starts, pc) - 1
+    if n >= 0:
+        address, size, name = functions[n]
+        if pc < address + max(size, 1):
+            return name
+    return '0x%08x' % pc
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Flat profile from a ktOS PC sampling dump.')
+    parser.add_argument('elf', help='the firmware, e.g. ktos.elf')
+    parser.add_argument('dump', help='binary dump of ktos_profiler')
+    parser.add_argument('--names', help='task names, e.g. 0=foo,1=bar')
+    parser.add_argument('--top', type=int, default=20, help='functions shown per task')
+    args = parser.parse_args()
+
+    names = {PROFILER_NO_TASK: 'ISR'}
+    if args.names:
+        for item in args.names.split(','):
+            pid, name = item.split('=', 1)
+            names[int(pid)] = name
+
+    with open(args.elf, 'rb') as f:
+        functions = Elf32(f.read()).functions()
+    with open(args.dump, 'rb') as f:
+        rate_hz, samples = read_samples(f.read())
+    if not samples:
+        sys.exit('no samples')
+
+    per_task = collections.defaultdict(collections.Counter)
+    for pc, task in samples:
+        per_task[task][symbolize(functions, pc)] += 1
+
+    print('%d samples at %d Hz (%.2f s)' % (len(samples), rate_hz, len(samples) / float(rate_hz)))
+    for task, counter in sorted(per_task.items(), key=lambda item: -sum(item[1].values())):
+        total = sum(counter.values())
+        print('\n%s: %d samples, %.1f%%' % (names.get(task, 'task %d' % task), total, 100.0 * total / len(samples)))
+        for name, count in counter.most_common(args.top):
+            print('  %6.1f%%  %6d  %s' % (100.0 * count / total, count, name))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+#
+# trace2chrome.py @ ktOS
+#
+# Convert a dump of ktos_trace into Chrome trace JSON (chrome://tracing, Perfetto).
+#
+# Build with USE_TRACE set to 1 in src/config.h, then dump the buffer with gdb:
+#     (gdb) dump binary value trace.bin ktos_trace
+# and convert it:
+#     ./tools/trace2chrome.py trace.bin -o trace.json --names 0=foo,1=bar
+#
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x6b745452
+HEADER = struct.Struct('<IIII')
+RECORD = struct.Struct('<IBBH')
+
+# Keep in sync with TRACE_EVENT_CODE in src/types.h.
+TRACE_TASK_SWITCH = 1
+TRACE_SYSCALL = 2
+TRACE_QUEUE_SEND = 3
+TRACE_QUEUE_RECEIVE = 4
+TRACE_QUEUE_BLOCK = 5
+TRACE_ISR_ENTER = 6
+TRACE_ISR_EXIT = 7
+TRACE_TICK = 8
+TRACE_TIMER_EXPIRE = 9
+TRACE_NO_TASK = 0xff
+
+SYSCALL_NAMES = {
+    22: 'StartOs', 23: 'TaskSleep', 24: 'TaskKill', 25: 'QueueSend',
+    26: 'QueueReceive', 31: 'TaskNotifyWait', 32: 'TaskSleepUs', 33: 'TaskSleepUntil',
+    39: 'ObjectWait',
+}
+
+PID = 1
+ISR_TID = 1000
+TIMER_TID = 1001
+
+
+def read_records(data):
+    magic, size, core_clock, head = HEADER.unpack_from(data, 0)
+    if magic != TRACE_MAGIC:
+        sys.exit('not a ktos_trace dump (magic 0x%08x)' % magic)
+    if len(data) < HEADER.size + size * RECORD.size:
+        sys.exit('dump is truncated, expected %d records' % size)
+
+    # The buffer is a ring, the oldest record follows the newest one once it wrapped.
+    count = min(head, size)
+    first = head - count
+    records = []
+    for n in range(first, head):
+        offset = HEADER.size + (n % size) * RECORD.size
+        records.append(RECORD.unpack_from(data, offset))
+
+    # Unwrap the 32-bit cycle counter, records are assumed to be less than 2^32 cycles apart.
+    base = 0
+    last = None
+    unwrapped = []
+    for cycles, event, task, arg in records:
+        if last is not None and cycles < last:
+            base += 1 << 32
+        last = cycles
+        unwrapped.append((base + cycles, event, task, arg))
+    return core_clock, unwrapped
+
+
+def convert(core_clock, records, names):
+    cycles_per_us = core_clock / 1e6
+    start = records[0][0] if records else 0
+    events = []
+
+    def ts(cycles):
+        return (cycles - start) / cycles_per_us
+
+    def task_name(task):
+        return names.get(task, 'task %d' % task)
+
+    tids = set()
+    running = None
+    slice_start = None
+    isr_stack = []
+    for cycles, event, task, arg in records:
+        if task != TRACE_NO_TASK:
+            tids.add(task)
+        if event == TRACE_TASK_SWITCH:
+            if running is not None:
+                events.append({'name': task_name(running), 'ph': 'X', 'pid': PID, 'tid': running,
+                               'ts': ts(slice_start), 'dur': ts(cycles) - ts(slice_start)})
+            running = task
+            slice_start = cycles
+        elif event == TRACE_ISR_ENTER:
+            isr_stack.append((arg, cycles))
+        elif event == TRACE_ISR_EXIT:
+            if isr_stack:
+                number, enter = isr_stack.pop()
+                events.append({'name': 'exception %d' % number, 'ph': 'X', 'pid': PID, 'tid': ISR_TID,
+                               'ts': ts(enter), 'dur': ts(cycles) - ts(enter)})
+        elif event == TRACE_SYSCALL:
+            events.append({'name': SYSCALL_NAMES.get(arg, 'syscall %d' % arg), 'ph': 'i', 's': 't',
+                           'pid': PID, 'tid': task, 'ts': ts(cycles)})
+        elif event in (TRACE_QUEUE_SEND, TRACE_QUEUE_RECEIVE, TRACE_QUEUE_BLOCK):
+            name = {TRACE_QUEUE_SEND: 'send', TRACE_QUEUE_RECEIVE: 'receive', TRACE_QUEUE_BLOCK: 'block'}[event]
+            events.append({'name': 'queue %d %s' % (arg, name), 'ph': 'i', 's': 't',
+                           'pid': PID, 'tid': task, 'ts': ts(cycles)})
+        elif event == TRACE_TIMER_EXPIRE:
+            events.append({'name': 'timer %d' % arg, 'ph': 'i', 's': 't',
+                           'pid': PID, 'tid': TIMER_TID, 'ts': ts(cycles)})
+        elif event == TRACE_TICK:
+            events.append({'name': 'tick', 'ph': 'i', 's': 'p', 'pid': PID, 'tid': ISR_TID, 'ts': ts(cycles)})
+
+    metadata = [{'name': 'process_name', 'ph': 'M', 'pid': PID, 'args': {'name': 'ktOS'}},
+                {'name': 'thread_name', 'ph': 'M', 'pid': PID, 'tid': ISR_TID, 'args': {'name': 'ISR'}},
+                {'name': 'thread_name', 'ph': 'M', 'pid': PID, 'tid': TIMER_TID, 'args': {'name': 'timers'}}]
+    for tid in sorted(tids):
+        metadata.append({'name': 'thread_name', 'ph': 'M', 'pid': PID, 'tid': tid,
+                         'args': {'name': task_name(tid)}})
+    return {'traceEvents': metadata + events, 'displayTimeUnit': 'ns'}
+
+
+def parse_names(text):
+    names = {}
+    if text:
+        for item in text.split(','):
+            pid, name = item.split('=', 1)
+            names[int(pid)] = name
+    return names
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert a ktOS trace dump into Chrome trace JSON.')
+    parser.add_argument('dump', help='binary dump of ktos_trace')
+    parser.add_argument('-o', '--output', default='-', help='output file, stdout by default')
+    parser.add_argument('--names', help='task names, e.g. 0=foo,1=bar')
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as f:
+        core_clock, records = read_records(f.read())
+    trace = convert(core_clock, records, parse_names(args.names))
+
+    if args.output == '-':
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+
+
+if __name__ == '__main__':
+    main()